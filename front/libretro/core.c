@@ -320,11 +320,7 @@ static void check_variables(void) {
 }
 
 static struct vxt_peripheral *load_bios(const vxt_byte *data, int size, vxt_pointer base) {
-	struct vxt_peripheral *rom = vxtu_memory_create(&realloc, base, size, true);
-	if (!vxtu_memory_device_fill(rom, data, size)) {
-		log_cb(RETRO_LOG_ERROR, "vxtu_memory_device_fill() failed!\n");
-		return NULL;
-	}
+	struct vxt_peripheral *rom = vxtu_rom_create(&realloc, base, data, size);
 	LOG("Loaded BIOS @ 0x%X-0x%X\n", base, base + size - 1);
 	return rom;
 }
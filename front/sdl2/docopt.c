@@ -226,7 +226,7 @@ int elems_to_args(struct Elements *elements, struct DocoptArgs *args,
     for (i = 0; i < elements->n_options; i++) {
         option = &elements->options[i];
         if (help && option->value && strcmp(option->olong, "--help") == 0) {
-            for (j = 0; j < 20; j++)
+            for (j = 0; j < 21; j++)
                 puts(args->help_message[j]);
             return EXIT_FAILURE;
         } else if (version && option->value &&
@@ -239,6 +239,8 @@ int elems_to_args(struct Elements *elements, struct DocoptArgs *args,
             args->clean = option->value;
         } else if (strcmp(option->olong, "--edit") == 0) {
             args->edit = option->value;
+        } else if (strcmp(option->olong, "--fpu") == 0) {
+            args->fpu = option->value;
         } else if (strcmp(option->olong, "--halt") == 0) {
             args->halt = option->value;
         } else if (strcmp(option->olong, "--hdboot") == 0) {
@@ -301,7 +303,7 @@ int elems_to_args(struct Elements *elements, struct DocoptArgs *args,
 
 struct DocoptArgs docopt(int argc, char *argv[], const bool help, const char *version) {
     struct DocoptArgs args = {
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, NULL, NULL, (char *) "10.0", NULL,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, NULL, NULL, (char *) "10.0", NULL,
         NULL, NULL,
             usage_pattern,
             { "Usage: virtualxt [options]",
@@ -314,7 +316,8 @@ struct DocoptArgs docopt(int argc, char *argv[], const bool help, const char *ve
               "  --mute                  Disable audio.",
               "  --a20                   Enable support for A20 line.",
               "  --no-activity           Disable disk activity indicator.",
-              "  --no-idle               Disable CPU idle on INT28.",
+              "  --no-idle               Disable CPU idle detection.",
+              "  --fpu                   Install an 8087 math coprocessor.",
               "  --clean                 Remove config file and write a new default one.",
               "  --edit                  Open config file in system text editor.",
               "  --locate                Locate the configuration directory.",
@@ -333,6 +336,7 @@ struct DocoptArgs docopt(int argc, char *argv[], const bool help, const char *ve
         {NULL, "--a20", 0, 0, NULL},
         {NULL, "--clean", 0, 0, NULL},
         {NULL, "--edit", 0, 0, NULL},
+        {NULL, "--fpu", 0, 0, NULL},
         {NULL, "--halt", 0, 0, NULL},
         {NULL, "--hdboot", 0, 0, NULL},
         {"-h", "--help", 0, 0, NULL},
@@ -353,7 +357,7 @@ struct DocoptArgs docopt(int argc, char *argv[], const bool help, const char *ve
 
     elements.n_commands = 0;
     elements.n_arguments = 0;
-    elements.n_options = 17;
+    elements.n_options = 18;
     elements.commands = commands;
     elements.arguments = arguments;
     elements.options = options;
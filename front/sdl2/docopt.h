@@ -85,6 +85,7 @@ struct DocoptArgs {
     size_t a20;
     size_t clean;
     size_t edit;
+    size_t fpu;
     size_t halt;
     size_t hdboot;
     size_t help;
@@ -102,7 +103,7 @@ struct DocoptArgs {
     char *trace;
     /* special */
     const char *usage_pattern;
-    const char *help_message[20];
+    const char *help_message[21];
 };
 
 struct DocoptArgs docopt(int, char *[], bool, const char *);
@@ -63,7 +63,9 @@
 #endif
 
 #define CONFIG_FILE_NAME "config.ini"
-#define MIN_CLOCKS_PER_STEP 1
+// Guest time per step. Idle loops and halts are only fast-forwarded within a step,
+// so this has to be long compared to a DOS keyboard polling loop.
+#define STEP_USEC 1000
 #define MAX_PENALTY_USEC 1000
 
 FILE *trace_op_output = NULL;
@@ -104,9 +106,11 @@ Uint32 last_title_update = 0;
 int num_cycles = 0;
 double cpu_frequency = (double)VXT_DEFAULT_FREQUENCY / 1000000.0;
 bool cpu_paused = false;
+bool profiling = false;
 
 int num_devices = 0;
 struct vxt_peripheral *devices[VXT_MAX_PERIPHERALS] = { NULL };
+Uint64 device_create_time[VXT_MAX_PERIPHERALS] = { 0 };
 #define APPEND_DEVICE(d) { devices[num_devices++] = (d); }
 
 // Needed for detecting turbo mode on XT machines.
@@ -209,10 +213,10 @@ static int emu_loop(void *ptr) {
 	Uint64 start = SDL_GetPerformanceCounter();
 
 	while (SDL_AtomicGet(&running)) {
-		struct vxt_step res;
+		struct vxt_step res = {0};
 		SYNC(
 			if (!cpu_paused) {
-				res = vxt_system_step(vxt, MIN_CLOCKS_PER_STEP);
+				res = vxt_system_step(vxt, (int)(frequency * (double)STEP_USEC));
 				if (res.err != VXT_NO_ERROR) {
 					if (res.err == VXT_USER_TERMINATION)
 						SDL_AtomicSet(&running, 0);
@@ -243,6 +247,10 @@ static int emu_loop(void *ptr) {
 				penalty = (d > max_penalty) ? max_penalty : d;
 				break;
 			}
+
+			// Give the time back to the host instead of spinning when the guest is waiting.
+			if (!args.no_idle && (res.idle || res.halted))
+				SDL_Delay(1);
 		}
 		start = SDL_GetPerformanceCounter();
 	}
@@ -291,6 +299,29 @@ void monitors_window(mu_Context *ctx, vxt_system *s) {
 				mu_textbox_ex(ctx, buf, sizeof(buf), MU_OPT_NOINTERACT);
 			}
 		}
+
+		if (mu_header_ex(ctx, "Profiler", 0)) {
+			mu_layout_row(ctx, 2, (int[]){ 120, -1 }, 0);
+			if (mu_button_ex(ctx, profiling ? "Stop" : "Start", 0, MU_OPT_ALIGNCENTER)) {
+				profiling = !profiling;
+				if (profiling)
+					vxt_system_clear_profiler(s);
+				vxt_system_set_profiler(s, profiling);
+			}
+			mu_label(ctx, "Top Addresses:");
+
+			struct vxt_profile_entry top[10];
+			const int num = vxt_system_profile_addresses(s, top, 10);
+			mu_layout_row(ctx, 3, (int[]){ 60, 60, -1 }, 0);
+			for (int i = 0; i < num; i++) {
+				char buf[32];
+				snprintf(buf, sizeof(buf), "%05X", top[i].addr);
+				mu_label(ctx, buf);
+				mu_label(ctx, top[i].name);
+				snprintf(buf, sizeof(buf), "%llu", top[i].cycles);
+				mu_label(ctx, buf);
+			}
+		}
 		mu_end_window(ctx);
 	);
 }
@@ -589,6 +620,8 @@ static int load_config(void *user, const char *section, const char *name, const
 			args.no_activity |= atoi(value);
 		else if (!strcmp("no-idle", name))
 			args.no_idle |= atoi(value);
+		else if (!strcmp("fpu", name))
+			args.fpu |= atoi(value);
 		else if (!strcmp("harddrive", name) && !args.harddrive) {
 			static char harddrive_image_path[FILENAME_MAX + 2] = {0};
 			strncpy(harddrive_image_path, resolve_path(FRONTEND_ANY_PATH, value), FILENAME_MAX + 1);
@@ -648,9 +681,11 @@ static int load_modules(void *user, const char *section, const char *name, const
 			}
 
 			for (vxtu_module_entry_func *f = const_func; *f; f++) {
+				const Uint64 start = SDL_GetPerformanceCounter();
 				struct vxt_peripheral *p = (*f)(VXTU_CAST(user, void*, vxt_allocator*), (void*)&front_interface, value);
 				if (!p)
 					continue; // Assume the module chose not to be loaded.
+				device_create_time[num_devices] = SDL_GetPerformanceCounter() - start;
 				APPEND_DEVICE(p);
 			}
 
@@ -667,6 +702,24 @@ static int load_modules(void *user, const char *section, const char *name, const
 	return 1;
 }
 
+static long long startup_clock(void) {
+	return (long long)SDL_GetPerformanceCounter();
+}
+
+static void print_startup_report(vxt_system *s, Uint64 start) {
+	const double ms = 1000.0 / (double)SDL_GetPerformanceFrequency();
+	printf("Startup timing (ms):\n");
+	for (int i = 1; i < VXT_MAX_PERIPHERALS; i++) {
+		struct vxt_peripheral *device = vxt_system_peripheral(s, (vxt_byte)i);
+		if (device) {
+			const struct vxt_startup_timing t = vxt_system_startup_timing(s, (vxt_byte)i);
+			printf("%d - %s: create %.3f, install %.3f, reset %.3f\n", i, vxt_peripheral_name(device),
+				(double)device_create_time[i - 1] * ms, (double)t.install * ms, (double)t.reset * ms);
+		}
+	}
+	printf("Total: %.3f\n", (double)(SDL_GetPerformanceCounter() - start) * ms);
+}
+
 static int configure_peripherals(void *user, const char *section, const char *name, const char *value) {
 	return (vxt_system_configure(user, section, name, value) == VXT_NO_ERROR) ? 1 : 0;
 }
@@ -739,6 +792,7 @@ static bool write_default_config(const char *path, bool clean) {
 		";arstech_isa=\n"
 		";ch36x_isa=/dev/ch36xpci0\n"
 		";lua=lua/serial_debug.lua,0x3F8\n"
+		";flame=flame.folded\n"
 		"\n; GDB server module should always be loadad after the others.\n"
 		"; Otherwise you might have trouble with hardware breakpoints.\n"
 		";gdb=1234\n"
@@ -754,8 +808,13 @@ static bool write_default_config(const char *path, bool clean) {
 		"\n[lotech_ems]\n"
 		"memory=0xD0000\n"
 		"port=0x260\n"
+		";size=2048\n"
 		"\n[rifs]\n"
 		"port=0x178\n"
+		"\n[flame]\n"
+		";interval=10000\n"
+		";shadow=1\n"
+		";symbols=bios/GLABIOS.LST,0xF000\n"
 	);
 
 	fclose(fp);
@@ -922,6 +981,7 @@ int main(int argc, char *argv[]) {
 		printf("Modules are dynamically linked!\n");
 	#endif
 	printf("Loaded modules:\n");
+	const Uint64 startup_start = SDL_GetPerformanceCounter();
 
 	if (ini_parse(sprint("%s/" CONFIG_FILE_NAME, args.config), &load_modules, VXTU_CAST(&realloc, vxt_allocator*, void*))) {
 		printf("ERROR: Could not load all modules!\n");
@@ -936,6 +996,7 @@ int main(int argc, char *argv[]) {
 
 	// Initializing this here is a bit late. But it works.
 	front_interface.ctrl.userdata = vxt;
+	vxt_system_set_startup_clock(vxt, &startup_clock);
 
 	if (ini_parse(sprint("%s/" CONFIG_FILE_NAME, args.config), &configure_peripherals, vxt)) {
 		printf("ERROR: Could not configure all peripherals!\n");
@@ -999,6 +1060,12 @@ int main(int argc, char *argv[]) {
 		//return -1;
 	}
 
+	if (args.fpu) {
+		vxt_system_set_fpu(vxt, true);
+		if (ppi_device)
+			vxtu_ppi_set_xt_switches(ppi_device, vxtu_ppi_xt_switches(ppi_device) | 2);
+	}
+
 	if (!disk_controller.device) {
 		printf("No disk controller!\n");
 		return -1;
@@ -1024,7 +1091,11 @@ int main(int argc, char *argv[]) {
 	print_memory_map(vxt);
 
 	vxt_system_reset(vxt);
+	if (SDL_getenv("VXT_STARTUP_REPORT"))
+		print_startup_report(vxt, startup_start);
+
 	vxt_system_registers(vxt)->debug = args.halt != 0;
+	vxt_system_set_idle_detection(vxt, args.no_idle == 0);
 
 	if (!(emu_mutex = SDL_CreateMutex())) {
 		printf("SDL_CreateMutex failed!\n");
@@ -84,6 +84,7 @@ struct DocoptArgs {
     /* options without arguments */
     size_t clean;
     size_t edit;
+    size_t fpu;
     size_t halt;
     size_t hdboot;
     size_t help;
@@ -99,7 +100,7 @@ struct DocoptArgs {
     char *rifs;
     /* special */
     const char *usage_pattern;
-    const char *help_message[17];
+    const char *help_message[18];
 };
 
 struct DocoptArgs docopt(int, char *[], bool, const char *);
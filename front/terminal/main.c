@@ -297,6 +297,8 @@ static int load_config(void *user, const char *section, const char *name, const
 			args.halt |= atoi(value);
 		else if (!strcmp("no-idle", name))
 			args.no_idle |= atoi(value);
+		else if (!strcmp("fpu", name))
+			args.fpu |= atoi(value);
 		else if (!strcmp("harddrive", name) && !args.harddrive) {
 			static char harddrive_image_path[FILENAME_MAX + 2] = {0};
 			strncpy(harddrive_image_path, resolve_path(FRONTEND_ANY_PATH, value), FILENAME_MAX + 1);
@@ -439,14 +441,20 @@ static bool write_default_config(const char *path, bool clean) {
 		"rifs=\n"
 		"ctrl=\n"
 		"ems=lotech_ems\n"
+		";flame=flame.folded\n"
 		"\n; GDB server module should always be loadad after the others.\n"
 		"; Otherwise you might have trouble with hardware breakpoints.\n"
 		";gdb=1234\n"
 		"\n[lotech_ems]\n"
 		"memory=0xD0000\n"
 		"port=0x260\n"
+		";size=2048\n"
 		"\n[rifs]\n"
 		"port=0x178\n"
+		"\n[flame]\n"
+		";interval=10000\n"
+		";shadow=1\n"
+		";symbols=bios/GLABIOS.LST,0xF000\n"
 	);
 
 	fclose(fp);
@@ -629,9 +637,9 @@ int main(int argc, char *argv[]) {
 		if (device) {
 			VXT_LOG("%d - %s", i, vxt_peripheral_name(device));
 
-			// Setup MDA video
+			// Setup MDA video and the math coprocessor switch.
 			if (vxt_peripheral_class(device) == VXT_PCLASS_PPI)
-        		vxtu_ppi_set_xt_switches(device, vxtu_ppi_xt_switches(device) | 0x30);
+        		vxtu_ppi_set_xt_switches(device, vxtu_ppi_xt_switches(device) | 0x30 | (args.fpu ? 2 : 0));
         }
 	}
 
@@ -661,6 +669,8 @@ int main(int argc, char *argv[]) {
 
 	vxt_system_reset(vxt);
 	vxt_system_registers(vxt)->debug = args.halt != 0;
+	vxt_system_set_idle_detection(vxt, args.no_idle == 0);
+	vxt_system_set_fpu(vxt, args.fpu != 0);
 
 	if (tb_init())
 		return -1;
@@ -131,11 +131,7 @@ static int tell_file(vxt_system *s, void *fp) {
 }
 
 static struct vxt_peripheral *load_bios(const vxt_byte *data, int size, vxt_pointer base) {
-	struct vxt_peripheral *rom = vxtu_memory_create(&ALLOCATOR, base, size, true);
-	if (!vxtu_memory_device_fill(rom, data, size)) {
-		LOG("vxtu_memory_device_fill() failed!\n");
-		return NULL;
-	}
+	struct vxt_peripheral *rom = vxtu_rom_create(&ALLOCATOR, base, data, size);
 	LOG("Loaded BIOS @ 0x%X-0x%X\n", base, base + size - 1);
 	return rom;
 }
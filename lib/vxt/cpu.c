@@ -27,18 +27,59 @@
 #include "exec_ext.inl"
 #include "optab.inl"
 
+static void flush_queue(CONSTSP(cpu) p) {
+   p->inst_queue_count = 0;
+   p->biu_cycles = 0;
+}
+
 #ifndef VXT_NO_PREFETCH
-   static void prefetch(CONSTSP(cpu) p, int num) {
-      int i = 0;
-      for (; i < num; i++) {
-         if (p->inst_queue_count >= 6)
-            return;
+   // Even addresses are fetched as words. Code is almost always in RAM or ROM so this avoids the device dispatch.
+   static vxt_word fetch_word(CONSTSP(cpu) p, vxt_pointer addr) {
+      const vxt_pointer a = addr & p->s->a20_mask;
+      if (LIKELY(a < MEM_SPACE_SIZE)) {
+         const vxt_byte *page = p->s->mem_pages[a >> MEM_PAGE_SHIFT].read;
+         if (LIKELY(page != NULL)) {
+            page += a & MEM_PAGE_MASK;
+            return WORD(page[1], page[0]);
+         }
+      }
+      return WORD(vxt_system_read_byte(p->s, addr + 1), vxt_system_read_byte(p->s, addr));
+   }
+
+   static void queue_byte(CONSTSP(cpu) p, vxt_pointer ptr, vxt_byte data) {
+      const int tail = (p->inst_queue_head + p->inst_queue_count++) & INST_QUEUE_MASK;
+      p->inst_queue[tail] = data;
+      #ifdef VXT_DEBUG_PREFETCH
+         p->inst_queue_debug[tail] = ptr;
+      #else
+         UNUSED(ptr);
+      #endif
+   }
+
+   // The bus interface unit uses the bus cycles that the execution unit left idle to fill the queue.
+   static void prefetch(CONSTSP(cpu) p, int cycles) {
+      p->biu_cycles += cycles - p->bus_transfers * BUS_CYCLE;
+      if (p->biu_cycles < 0)
+         p->biu_cycles = 0;
 
-         vxt_pointer ptr = VXT_POINTER(p->regs.cs, p->regs.ip + p->inst_queue_count);
-         p->inst_queue_debug[p->inst_queue_count] = ptr;
-         p->inst_queue[p->inst_queue_count++] = vxt_system_read_byte(p->s, ptr);
+      while ((p->biu_cycles >= BUS_CYCLE) && (p->inst_queue_count < INST_QUEUE_SIZE)) {
+         const vxt_word ip = p->regs.ip + p->inst_queue_count;
+         const vxt_pointer ptr = VXT_POINTER(p->regs.cs, ip);
+
+         if (!(ip & 1) && (p->biu_cycles >= BUS_CYCLE * 2) && (p->inst_queue_count <= INST_QUEUE_SIZE - 2)) {
+            const vxt_word data = fetch_word(p, ptr);
+            queue_byte(p, ptr, LBYTE(data));
+            queue_byte(p, ptr + 1, HBYTE(data));
+            p->biu_cycles -= BUS_CYCLE * 2;
+         } else {
+            queue_byte(p, ptr, vxt_system_read_byte(p->s, ptr));
+            p->biu_cycles -= BUS_CYCLE;
+         }
       }
-      //if (i > 0) VXT_LOG("Prefetch %d bytes... %d", i, num);
+
+      // The BIU idles while the queue is full.
+      if (p->inst_queue_count == INST_QUEUE_SIZE)
+         p->biu_cycles = 0;
    }
 #endif
 
@@ -85,12 +126,15 @@ static void prep_exec(CONSTSP(cpu) p) {
    bool trap = (p->regs.flags & VXT_TRAP) != 0;
    bool interrupt = (p->regs.flags & VXT_INTERRUPT) != 0;
 
-   if (UNLIKELY(trap && !p->trap)) {
+   if (UNLIKELY(p->nmi_pending)) {
+      p->nmi_pending = p->halt = false;
+      call_int(p, 2);
+   } else if (UNLIKELY(trap && !p->trap)) {
       p->trap = interrupt;
       call_int(p, 1);
    } else if (UNLIKELY(interrupt)) {
       p->halt = p->trap = false;
-      if (LIKELY(p->pic != NULL)) {
+      if (UNLIKELY(p->irq_pending) && LIKELY(p->pic != NULL)) {
          int n = p->pic->pic.next(vxt_peripheral_device(p->pic));
          if (n >= 0)
             call_int(p, n);
@@ -99,7 +143,7 @@ static void prep_exec(CONSTSP(cpu) p) {
 
    // We need to do a direct reset in case we do interrupt.
    if (UNLIKELY(p->inst_queue_dirty)) {
-      p->inst_queue_count = 0;
+      flush_queue(p);
       p->inst_queue_dirty = false;
    }
 
@@ -109,24 +153,159 @@ static void prep_exec(CONSTSP(cpu) p) {
    p->inst_start = p->regs.ip;
 }
 
-static void do_exec(CONSTSP(cpu) p) {
-	const CONSTSP(instruction) inst = &opcode_table[p->opcode];
-    p->inst = inst;
-    ENSURE(inst->opcode == p->opcode);
+#ifdef VXT_CPU_FAST
+   #define DISPATCH dispatch_fast
+#else
+   #define DISPATCH dispatch
+#endif
 
-    switch (inst->arch) {
-        case ARCH_8086:
-        case ARCH_80186:
-        case ARCH_80286:
-        case ARCH_FPU:
-            p->invalid = false;
-            break;
-        default:
-            p->invalid = true;
-    }
+static void decode(CONSTSP(cpu) p) {
+    read_opcode(p);
+    p->inst = p->DISPATCH[p->opcode].inst;
 
-    if (inst->modregrm)
+    if (p->inst->modregrm)
         read_modregrm(p);
+}
+
+static vxt_byte decoded_segment(CONSTSP(cpu) p) {
+    switch (p->seg_override) {
+        case 0x26: return 0;
+        case 0x2E: return 1;
+        case 0x36: return 2;
+        case 0x3E: return 3;
+    }
+
+    // Mirrors override_with_ss in read_modregrm.
+    if (p->inst->modregrm && modregrm_table[p->mode.modregrm].use_ss)
+        return 2;
+    return 3;
+}
+
+static bool same_bytes(const vxt_byte *a, const vxt_byte *b, int n) {
+    for (int i = 0; i < n; i++) {
+        if (a[i] != b[i])
+            return false;
+    }
+    return true;
+}
+
+static bool same_queue(CONSTSP(cpu) p, const vxt_byte *b, int n) {
+    for (int i = 0; i < n; i++) {
+        if (p->inst_queue[(p->inst_queue_head + i) & INST_QUEUE_MASK] != b[i])
+            return false;
+    }
+    return true;
+}
+
+static void decode_cache_store(CONSTSP(cpu) p, vxt_pointer addr, vxt_word ip, int cycles, int queued, const vxt_byte *queue) {
+    struct mem_page *mp = &p->s->mem_pages[addr >> MEM_PAGE_SHIFT];
+    const int length = (vxt_word)(p->regs.ip - ip);
+
+    if (!mp->read || (length > DECODE_MAX_BYTES) || ((ip + length) > 0x10000) || (((addr & MEM_PAGE_MASK) + length) > MEM_PAGE_SIZE))
+        return;
+
+    const vxt_byte *mem = &mp->read[addr & MEM_PAGE_MASK];
+    if (!same_bytes(queue, mem, (queued < length) ? queued : length))
+        return; // Stale bytes in the prefetch queue.
+
+    CONSTSP(decoded_inst) d = &p->decode_cache[addr & (DECODE_CACHE_SIZE - 1)];
+    d->addr = addr;
+    d->gen = p->s->tables->code_gen[addr >> CODE_LINE_SHIFT];
+    d->inst = p->inst;
+    d->mode = p->mode;
+    d->opcode = p->opcode;
+    d->repeat = p->repeat;
+    d->seg_override = p->seg_override;
+    d->seg_reg = decoded_segment(p);
+    d->length = (vxt_byte)length;
+    d->cycles = (vxt_byte)(p->cycles - cycles);
+    memcpy(d->bytes, mem, length);
+
+    if (mp->writable) {
+        const int offset = addr & MEM_PAGE_MASK;
+        for (int i = offset >> CODE_LINE_SHIFT; i <= ((offset + length - 1) >> CODE_LINE_SHIFT); i++)
+            mp->code |= 1u << i;
+        mp->write = NULL;
+    }
+}
+
+static bool decode_cache_load(CONSTSP(cpu) p, vxt_pointer addr) {
+    const CONSTSP(decoded_inst) d = &p->decode_cache[addr & (DECODE_CACHE_SIZE - 1)];
+    if ((d->addr != addr) || (d->gen != p->s->tables->code_gen[addr >> CODE_LINE_SHIFT]))
+        return false;
+
+    // The queue could hold bytes that was fetched before the code was modified.
+    const int queued = (p->inst_queue_count < d->length) ? p->inst_queue_count : d->length;
+    if (!same_queue(p, d->bytes, queued))
+        return false;
+
+    p->inst_queue_head = (p->inst_queue_head + queued) & INST_QUEUE_MASK;
+    p->inst_queue_count -= queued;
+    p->bus_transfers += d->length - queued;
+    p->regs.ip += d->length;
+
+    p->inst = d->inst;
+    p->opcode = d->opcode;
+    p->repeat = d->repeat;
+    p->seg_override = d->seg_override;
+    p->cycles += d->cycles;
+    if (d->inst->modregrm)
+        p->mode = d->mode;
+
+    CONSTSP(vxt_registers) r = &p->regs;
+    switch (d->seg_reg) {
+        case 0: p->seg = r->es; break;
+        case 1: p->seg = r->cs; break;
+        case 2: p->seg = r->ss; break;
+        default: p->seg = r->ds; break;
+    }
+    return true;
+}
+
+static void cached_decode(CONSTSP(cpu) p) {
+    const vxt_pointer addr = VXT_POINTER(p->regs.cs, p->regs.ip) & p->s->a20_mask;
+    if (addr >= 0x100000) {
+        decode(p);
+        return;
+    }
+
+    if (LIKELY(decode_cache_load(p, addr)))
+        return;
+
+    const vxt_word ip = p->regs.ip;
+    const int cycles = p->cycles;
+    const int queued = p->inst_queue_count;
+    vxt_byte queue[INST_QUEUE_SIZE];
+    for (int i = 0; i < queued; i++)
+        queue[i] = p->inst_queue[(p->inst_queue_head + i) & INST_QUEUE_MASK];
+
+    decode(p);
+    decode_cache_store(p, addr, ip, cycles, queued, queue);
+}
+
+// Instructions that neither read nor partially update the arithmetic flags.
+static bool keeps_lazy_flags(vxt_byte op) {
+   if (op < 0x40) // ADD, OR, AND, SUB, XOR and CMP
+      return ((op & 7) < 6) && ((op & 0xF0) != 0x10);
+
+   switch (op) {
+      case 0x9B: case 0x9C: case 0x9D: case 0x9E: case 0x9F: // WAIT, PUSHF, POPF, SAHF and LAHF
+      case 0xA6: case 0xA7: case 0xAE: case 0xAF: // CMPS and SCAS write the flags directly
+         return false;
+      case 0xC2: case 0xC3: case 0xC6: case 0xC7:
+      case 0xE8: case 0xE9: case 0xEA: case 0xEB:
+         return true;
+   }
+   return ((op >= 0x50) && (op <= 0x5F)) || ((op >= 0x80) && (op <= 0xBF));
+}
+
+static void do_exec(CONSTSP(cpu) p, int start_cycles) {
+	const CONSTSP(instruction) inst = p->inst;
+
+    if (p->lazy.op && !keeps_lazy_flags(p->opcode))
+        flags_materialize(p);
+
+    p->invalid = p->DISPATCH[p->opcode].invalid;
     inst->func(p);
 
     if (p->invalid)
@@ -135,10 +314,12 @@ static void do_exec(CONSTSP(cpu) p) {
     p->cycles += inst->cycles;
 
     if (UNLIKELY(p->inst_queue_dirty)) {
-        p->inst_queue_count = 0;
+        flush_queue(p);
     } else {
         #ifndef VXT_NO_PREFETCH
-            prefetch(p, (p->cycles / 2) - p->bus_transfers); // TODO: Round up or down?
+            prefetch(p, p->cycles - start_cycles);
+        #else
+            UNUSED(start_cycles);
         #endif
     }
 }
@@ -150,38 +331,248 @@ static vxt_byte cpu_read_byte(CONSTSP(cpu) p, vxt_pointer addr) {
    return data;
 }
 
+static void hash_write(CONSTSP(cpu) p, vxt_pointer addr, vxt_word data) {
+   p->write_hash = (p->write_hash ^ (addr << 12) ^ data) * 0x9E3779B1;
+}
+
 static void cpu_write_byte(CONSTSP(cpu) p, vxt_pointer addr, vxt_byte data) {
    vxt_system_write_byte(p->s, addr, data);
+   hash_write(p, addr, data);
    p->bus_transfers++;
    VALIDATOR_WRITE(p, addr, data);
 }
 
+// Opcodes that the 8088 decodes as other instructions.
+static vxt_byte alias_8088(vxt_byte op) {
+   if ((op >= 0x60) && (op <= 0x6F))
+      return op + 0x10;
+
+   switch (op) {
+      case 0xC0: return 0xC2;
+      case 0xC1: return 0xC3;
+      case 0xC8: return 0xCA;
+      case 0xC9: return 0xCB;
+      case 0xF1: return 0xF0;
+   }
+   return op;
+}
+
+void cpu_set_model(CONSTSP(cpu) p, enum vxt_cpu_model model) {
+   for (int i = 0; i < 0x100; i++) {
+      const struct instruction *inst = &opcode_table[i];
+      if (model == VXT_CPU_8088)
+         inst = (i == 0xF) ? &pop_cs_instruction : &opcode_table[alias_8088((vxt_byte)i)];
+
+      bool valid = false;
+      switch (inst->arch) {
+         case ARCH_8086:
+         case ARCH_FPU:
+            valid = true;
+            break;
+         case ARCH_80186:
+            valid = model >= VXT_CPU_80186;
+            break;
+         case ARCH_80286:
+            valid = model >= VXT_CPU_80286;
+            break;
+         default:
+            break;
+      }
+
+      // Instructions from later models are not executed at all.
+      if (!valid && ((inst->arch == ARCH_80186) || (inst->arch == ARCH_80286)))
+         inst = &invalid_instruction;
+      p->DISPATCH[i] = (struct dispatch){ inst, !valid };
+   }
+}
+
+#ifndef VXT_CPU_FAST
+   // Only the instrumented core profiles. vxt_system_step switches to it while the profiler runs.
+   static void push_frame(CONSTSP(profiler) prof, vxt_pointer addr, vxt_word ss, vxt_word sp) {
+      if (prof->depth == PROFILER_STACK) {
+         // Frames that were never returned from, like stack switches, eventually fall off the bottom.
+         for (int i = 1; i < PROFILER_STACK; i++)
+            prof->stack[i - 1] = prof->stack[i];
+         prof->depth--;
+      }
+      prof->stack[prof->depth++] = (struct profile_frame){ addr, ss, sp };
+   }
+
+   static void update_call_stack(CONSTSP(cpu) p, vxt_pointer addr, vxt_word sp) {
+      CONSTSP(profiler) prof = p->profiler;
+      CONSTSP(vxt_registers) r = &p->regs;
+
+      // The instruction did not start where the last one ended. An interrupt was taken in between.
+      if ((prof->next != VXT_INVALID_POINTER) && (prof->next != addr))
+         push_frame(prof, addr, r->ss, sp);
+
+      while (prof->depth && (prof->stack[prof->depth - 1].ss == r->ss) && (r->sp > prof->stack[prof->depth - 1].sp))
+         prof->depth--;
+
+      bool call = false;
+      switch (p->opcode) {
+         case 0x9A: case 0xCC: case 0xCD: case 0xCE: case 0xE8:
+            call = true;
+            break;
+         case 0xFF:
+            call = (p->mode.reg == 2) || (p->mode.reg == 3);
+            break;
+      }
+
+      prof->next = VXT_POINTER(r->cs, r->ip) & p->s->a20_mask;
+      if (call && (r->sp < sp))
+         push_frame(prof, prof->next, r->ss, r->sp);
+   }
+
+   static void profile_step(CONSTSP(cpu) p, vxt_word cs, vxt_word sp, int cycles) {
+      CONSTSP(profiler) prof = p->profiler;
+      struct vxt_profile_entry *e = &prof->opcodes[p->opcode];
+      e->name = p->inst->name;
+      e->count++;
+      e->cycles += (unsigned long long)cycles;
+
+      const vxt_pointer addr = VXT_POINTER(cs, p->inst_start) & p->s->a20_mask;
+      update_call_stack(p, addr, sp);
+
+      vxt_dword i = (addr * 0x9E3779B1u) >> (32 - PROFILER_BITS);
+      for (;; i = (i + 1) & (PROFILER_SIZE - 1)) {
+         e = &prof->addresses[i];
+         if (e->addr == addr)
+            break;
+
+         if (e->addr == VXT_INVALID_POINTER) {
+            if (prof->num_addresses >= (PROFILER_SIZE / 4) * 3) {
+               prof->dropped++;
+               return;
+            }
+            prof->num_addresses++;
+            e->addr = addr;
+            break;
+         }
+      }
+
+      e->opcode = p->opcode;
+      e->name = p->inst->name;
+      e->count++;
+      e->cycles += (unsigned long long)cycles;
+   }
+#endif
+
 int cpu_step(CONSTSP(cpu) p) {
     VALIDATOR_BEGIN(p, &p->regs);
 
+    const int start_cycles = p->cycles;
     prep_exec(p);
     if (LIKELY(!p->halt)) {
-        read_opcode(p);
-        do_exec(p);
+        #ifndef VXT_CPU_FAST
+            const vxt_word cs = p->regs.cs;
+            const vxt_word sp = p->regs.sp;
+        #endif
+
+        // Tracing and validation needs to observe every opcode fetch.
+        if (p->use_decode_cache && !CPU_INSTRUMENTED(p))
+            cached_decode(p);
+        else
+            decode(p);
+        do_exec(p, start_cycles);
+
+        #ifndef VXT_CPU_FAST
+            if (UNLIKELY(p->profiling))
+                profile_step(p, cs, sp, p->cycles - start_cycles);
+        #endif
     } else {
         p->cycles++;
     }
 
+    if (UNLIKELY(CPU_INSTRUMENTED(p)))
+        flags_materialize(p);
     VALIDATOR_END(p, p->inst->name, p->opcode, p->inst->modregrm, p->cycles, &p->regs);
 
     ENSURE(p->cycles > 0);
     return p->cycles;
 }
 
+vxt_word cpu_segment_read_byte(CONSTSP(cpu) p, vxt_word segment, vxt_word offset) {
+   return cpu_read_byte(p, VXT_POINTER(segment, offset));
+}
+
+// The 8088 still needs two bus transfers for a word.
+vxt_word cpu_segment_read_word(CONSTSP(cpu) p, vxt_word segment, vxt_word offset) {
+   if (UNLIKELY(offset == 0xFFFF))
+      return WORD(cpu_read_byte(p, VXT_POINTER(segment, 0)), cpu_read_byte(p, VXT_POINTER(segment, offset)));
+
+   const vxt_pointer addr = VXT_POINTER(segment, offset);
+   const vxt_word data = vxt_system_read_word(p->s, addr);
+   p->bus_transfers += 2;
+   VALIDATOR_READ(p, addr, LBYTE(data));
+   VALIDATOR_READ(p, addr + 1, HBYTE(data));
+   return data;
+}
+
+void cpu_segment_write_byte(CONSTSP(cpu) p, vxt_word segment, vxt_word offset, vxt_word data) {
+   cpu_write_byte(p, VXT_POINTER(segment, offset), data);
+}
+
+void cpu_segment_write_word(CONSTSP(cpu) p, vxt_word segment, vxt_word offset, vxt_word data) {
+   if (UNLIKELY(offset == 0xFFFF)) {
+      cpu_write_byte(p, VXT_POINTER(segment, offset), LBYTE(data));
+      cpu_write_byte(p, VXT_POINTER(segment, 0), HBYTE(data));
+      return;
+   }
+
+   const vxt_pointer addr = VXT_POINTER(segment, offset);
+   vxt_system_write_word(p->s, addr, data);
+   hash_write(p, addr, data);
+   p->bus_transfers += 2;
+   VALIDATOR_WRITE(p, addr, LBYTE(data));
+   VALIDATOR_WRITE(p, addr + 1, HBYTE(data));
+}
+
+// State handling is shared by both variants of the core.
+#ifndef VXT_CPU_FAST
+
 void cpu_reset_cycle_count(CONSTSP(cpu) p) {
    p->cycles = 0;
    p->interrupt = p->int28 = false;
    p->invalid = false;
 }
 
+void cpu_update_flags(CONSTSP(cpu) p) {
+	flags_materialize(p);
+}
+
+// The NMI is edge triggered, so it is only raised when the gated 8087 interrupt goes high.
+void cpu_update_nmi(CONSTSP(cpu) p, bool enabled, bool fpu_int) {
+	if (enabled && fpu_int && !(p->nmi_enabled && p->fpu_int))
+		p->nmi_pending = true;
+	p->nmi_enabled = enabled;
+	p->fpu_int = fpu_int;
+}
+
+void cpu_flush_decode_cache(CONSTSP(cpu) p) {
+	if (!p->decode_cache)
+		return;
+	for (int i = 0; i < DECODE_CACHE_SIZE; i++)
+		p->decode_cache[i].addr = (vxt_pointer)-1;
+}
+
+void cpu_clear_profiler(CONSTSP(cpu) p) {
+	CONSTSP(profiler) prof = p->profiler;
+	if (!prof)
+		return;
+
+	vxt_memclear(prof, sizeof(struct profiler));
+	for (int i = 0; i < 0x100; i++)
+		prof->opcodes[i].opcode = (vxt_byte)i;
+	for (int i = 0; i < PROFILER_SIZE; i++)
+		prof->addresses[i].addr = VXT_INVALID_POINTER;
+	prof->next = VXT_INVALID_POINTER;
+}
+
 void cpu_reset(CONSTSP(cpu) p) {
 	p->trap = false;
 	vxt_memclear(&p->regs, sizeof(p->regs));
+	p->lazy.op = LAZY_NONE;
 
 	p->regs.flags = 2;
 	#ifdef FLAG8086
@@ -194,27 +585,15 @@ void cpu_reset(CONSTSP(cpu) p) {
 	#endif
 
 	p->regs.debug = false;
-	p->inst_queue_count = 0;
+	p->nmi_enabled = p->fpu_int = p->nmi_pending = false;
+	#ifndef VXT_NO_FPU
+		fpu_reset(p);
+	#endif
+	flush_queue(p);
+	cpu_flush_decode_cache(p);
 	cpu_reset_cycle_count(p);
 }
 
-vxt_word cpu_segment_read_byte(CONSTSP(cpu) p, vxt_word segment, vxt_word offset) {
-   return cpu_read_byte(p, VXT_POINTER(segment, offset));
-}
-
-vxt_word cpu_segment_read_word(CONSTSP(cpu) p, vxt_word segment, vxt_word offset) {
-   return WORD(cpu_read_byte(p, VXT_POINTER(segment, (offset + 1) & 0xFFFF)), cpu_read_byte(p, VXT_POINTER(segment, offset)));
-}
-
-void cpu_segment_write_byte(CONSTSP(cpu) p, vxt_word segment, vxt_word offset, vxt_word data) {
-   cpu_write_byte(p, VXT_POINTER(segment, offset), data);
-}
-
-void cpu_segment_write_word(CONSTSP(cpu) p, vxt_word segment, vxt_word offset, vxt_word data) {
-   cpu_write_byte(p, VXT_POINTER(segment, offset), LBYTE(data));
-   cpu_write_byte(p, VXT_POINTER(segment, (offset + 1) & 0xFFFF), HBYTE(data));
-}
-
 TEST(register_layout,
    struct vxt_registers regs = {0};
    regs.ax = 0x0102;
@@ -241,3 +620,553 @@ TEST(register_layout,
    TENSURE(regs.dl == 8);
    TENSURE(regs.dx == 0x0708);
 )
+
+#ifdef TESTING
+   static void test_tracer(vxt_system *s, vxt_pointer addr, vxt_byte data) {
+      UNUSED(s); UNUSED(addr); UNUSED(data);
+   }
+
+   static vxt_dword test_rand(vxt_dword *seed) {
+      *seed ^= *seed << 13;
+      *seed ^= *seed >> 17;
+      *seed ^= *seed << 5;
+      return *seed;
+   }
+
+   // Reference for the shift and rotate unit. Shifts one bit at the time, like the microcode does.
+   static vxt_word test_bitshift(vxt_word *flags, int op, vxt_word v, vxt_byte c, int bits) {
+      const vxt_word msb = (vxt_word)(1u << (bits - 1));
+      const vxt_word o = v;
+      if (c == 0)
+         return v;
+
+      for (int i = 0; i < c; i++) {
+         const vxt_word cf = *flags & VXT_CARRY;
+         switch (op) {
+            case 0: SET_FLAG_IF(*flags, VXT_CARRY, v & msb); v = (v << 1) | ((v & msb) ? 1 : 0); break;
+            case 1: SET_FLAG_IF(*flags, VXT_CARRY, v & 1); v = (v >> 1) | ((v & 1) ? msb : 0); break;
+            case 2: SET_FLAG_IF(*flags, VXT_CARRY, v & msb); v = (v << 1) | cf; break;
+            case 3: SET_FLAG_IF(*flags, VXT_CARRY, v & 1); v = (v >> 1) | (cf ? msb : 0); break;
+            case 4: case 6: SET_FLAG_IF(*flags, VXT_CARRY, v & msb); v <<= 1; break;
+            case 5: SET_FLAG_IF(*flags, VXT_CARRY, v & 1); v >>= 1; break;
+            case 7: SET_FLAG_IF(*flags, VXT_CARRY, v & 1); v = (v >> 1) | (v & msb); break;
+         }
+         v &= (vxt_word)((1u << bits) - 1);
+      }
+
+      const bool top = (v & msb) != 0;
+      const bool next = (v & (msb >> 1)) != 0;
+      struct vxt_registers r = {0};
+      r.flags = *flags;
+
+      switch (op) {
+         case 0: case 2: SET_FLAG_IF(r.flags, VXT_OVERFLOW, (r.flags & VXT_CARRY) ^ top); break;
+         case 1: case 3: SET_FLAG_IF(r.flags, VXT_OVERFLOW, top ^ next); break;
+         case 4: case 6: SET_FLAG_IF(r.flags, VXT_OVERFLOW, top != (r.flags & VXT_CARRY)); break;
+         case 5: SET_FLAG_IF(r.flags, VXT_OVERFLOW, (c == 1) && (o & msb)); break;
+         case 7: r.flags &= ~VXT_OVERFLOW; break;
+      }
+      if (op >= 4) {
+         if (bits == 8) flag_szp8(&r, (vxt_byte)v); else flag_szp16(&r, v);
+      }
+      *flags = r.flags;
+      return v;
+   }
+
+   static const vxt_byte test_string_ops[] = {
+      0xA4, 0xA5, 0xA6, 0xA7, 0xAA, 0xAB, 0xAC, 0xAD, 0xAE, 0xAF // MOVS, CMPS, STOS, LODS and SCAS
+   };
+
+   static const vxt_byte test_scas_code[] = {
+      0x3C, 0x01,             // CMP AL,1
+      0xB0, 0x42,             // MOV AL,0x42
+      0xBF, 0x00, 0x03,       // MOV DI,0x300
+      0xAE,                   // SCASB
+      0x74, 0x01,             // JZ +1
+      0xF4,                   // HLT
+      0x40,                   // INC AX
+      0xF4,                   // HLT
+      [0x20] =
+      0x30, 0xC0,             // XOR AL,AL
+      0xB9, 0x03, 0x00,       // MOV CX,3
+      0xBF, 0x01, 0x03,       // MOV DI,0x301
+      0xF2, 0xAE,             // REPNE SCASB
+      0x75, 0x01,             // JNE +1
+      0x40,                   // INC AX
+      0xF4                    // HLT
+   };
+
+   static const vxt_byte test_fpu_code[] = {
+      0xDB, 0xE3,             // FINIT
+      0xDF, 0x06, 0x00, 0x02, // FILD WORD [0x200]
+      0xD9, 0xE8,             // FLD1
+      0xDE, 0xC1,             // FADDP ST(1),ST
+      0xD9, 0xEB,             // FLDPI
+      0xDE, 0xC9,             // FMULP ST(1),ST
+      0xDF, 0x1E, 0x02, 0x02, // FISTP WORD [0x202]
+      0xDD, 0x06, 0x10, 0x02, // FLD QWORD [0x210]
+      0xDF, 0x1E, 0x04, 0x02, // FISTP WORD [0x204]
+      0xD9, 0x2E, 0x06, 0x02, // FLDCW [0x206]
+      0xDD, 0x06, 0x18, 0x02, // FLD QWORD [0x218]
+      0xDF, 0x1E, 0x08, 0x02, // FISTP WORD [0x208]
+      0xDF, 0x06, 0x00, 0x02, // FILD WORD [0x200]
+      0xD9, 0xEB,             // FLDPI
+      0xDE, 0xC9,             // FMULP ST(1),ST
+      0xDF, 0x36, 0x30, 0x02, // FBSTP [0x230]
+      0xD9, 0xEB,             // FLDPI
+      0xDB, 0x3E, 0x20, 0x02, // FSTP TBYTE [0x220]
+      0xDB, 0x2E, 0x20, 0x02, // FLD TBYTE [0x220]
+      0xD9, 0xEB,             // FLDPI
+      0xDE, 0xD9,             // FCOMPP
+      0xDD, 0x3E, 0x0A, 0x02  // FSTSW [0x20A]
+   };
+#endif
+
+// Compares the bulk paths of the repeated string instructions with stepping one element at the time, which is used
+// when a tracer is attached. Moves may overlap, and the instruction is sometimes placed in the destination page,
+// which then holds decoded code and has to be written through the bus.
+TEST(rep_compare_bulk,
+   vxt_byte *mem;
+   CONSTP(vxt_system) s = test_machine_create(&mem, NULL, NULL, 0);
+   TENSURE(s);
+   vxt_system_set_decode_cache(s, true);
+
+   vxt_byte *initial = (vxt_byte*)TALLOC(NULL, TEST_MEMORY_SIZE);
+   vxt_byte *expected = (vxt_byte*)TALLOC(NULL, TEST_MEMORY_SIZE);
+   TENSURE(initial && expected);
+
+   CONSTSP(cpu) p = &s->cpu;
+   vxt_dword seed = 1;
+
+   for (int i = 0; i < 0xF000; i++)
+      mem[i] = (test_rand(&seed) % 31) ? (vxt_byte)((i >> 12) & 1) : (vxt_byte)test_rand(&seed);
+
+   for (int i = 0; i < 20000; i++) {
+      const vxt_byte opcode = test_string_ops[test_rand(&seed) % sizeof(test_string_ops)];
+
+      struct vxt_registers regs = {0};
+      regs.ax = (test_rand(&seed) & 1) ? 0 : (vxt_word)test_rand(&seed);
+      regs.cx = test_rand(&seed) & 0x3FF;
+      regs.si = test_rand(&seed) & 0xEFFF;
+      regs.di = (test_rand(&seed) & 3) ? (test_rand(&seed) & 0xEFFF) : ((regs.si + (test_rand(&seed) % 9) - 4) & 0xEFFF);
+      regs.es = (test_rand(&seed) & 7) ? 0 : 0x800; // Runs past the end of RAM
+      regs.flags = (test_rand(&seed) & 1) ? (VXT_DIRECTION | 2) : 2;
+      regs.ip = (!regs.es && !(test_rand(&seed) & 3)) ? ((regs.di & ~MEM_PAGE_MASK) | (test_rand(&seed) & 0x7F0)) : 0xF000;
+
+      mem[regs.ip] = (test_rand(&seed) & 1) ? 0xF2 : 0xF3;
+      mem[regs.ip + 1] = opcode;
+      memcpy(initial, mem, TEST_MEMORY_SIZE);
+
+      struct vxt_registers result;
+      int cycles = 0;
+
+      for (int j = 0; j < 2; j++) {
+         if (j)
+            memcpy(mem, initial, TEST_MEMORY_SIZE);
+
+         p->tracer = j ? &test_tracer : NULL;
+         cpu_reset(p);
+         p->regs = regs;
+         cpu_step(p);
+         cpu_update_flags(p);
+
+         // A decoded instruction that was overwritten must have been invalidated.
+         const struct decoded_inst *d = &p->decode_cache[regs.ip & (DECODE_CACHE_SIZE - 1)];
+         if (!j && (d->addr == regs.ip) && (d->gen == s->tables->code_gen[regs.ip >> CODE_LINE_SHIFT]))
+            TASSERT(!memcmp(d->bytes, &mem[regs.ip], d->length), "Stale decoded instruction! (opcode 0x%X)", opcode);
+
+         if (j) {
+            TASSERT(!memcmp(&result, &p->regs, sizeof(result)), "Registers differ! (opcode 0x%X)", opcode);
+            TASSERT(cycles == p->cycles, "Cycles differ! (opcode 0x%X)", opcode);
+            TASSERT(!memcmp(expected, mem, TEST_MEMORY_SIZE), "Memory differs! (opcode 0x%X)", opcode);
+         }
+         result = p->regs;
+         cycles = p->cycles;
+         memcpy(expected, mem, TEST_MEMORY_SIZE);
+      }
+   }
+
+   TFREE(initial);
+   TFREE(expected);
+   test_machine_destroy(s, mem);
+)
+
+// Compares the closed form shift and rotate unit with shifting one bit at the time, for all counts the 8088 accepts.
+TEST(shift_closed_form,
+   CONSTP(vxt_system) s = vxt_system_create(TALLOC, VXT_DEFAULT_FREQUENCY, NULL);
+   TENSURE(s);
+   CONSTSP(cpu) p = &s->cpu;
+   vxt_dword seed = 1;
+
+   for (int op = 0; op < 8; op++) {
+      p->mode.reg = (vxt_byte)op;
+      for (int i = 0; i < 0x20000; i++) {
+         const int bits = (i & 1) ? 16 : 8;
+         const vxt_word v = (bits == 8) ? (vxt_word)((i >> 1) & 0xFF) : (vxt_word)test_rand(&seed);
+         const vxt_byte c = (vxt_byte)((i < 0x10000) ? (vxt_dword)((i >> 9) % 36) : test_rand(&seed));
+         const vxt_word flags = (vxt_word)test_rand(&seed) | 2;
+
+         vxt_word expected_flags = flags;
+         const vxt_word expected = test_bitshift(&expected_flags, op, v, c, bits);
+
+         p->regs.flags = flags;
+         const vxt_word result = (bits == 8) ? bitshift_8(p, (vxt_byte)v, c) : bitshift_16(p, v, c);
+         TASSERT((result == expected) && (p->regs.flags == expected_flags),
+            "Shift %d of 0x%X by %d (%d bits) gave 0x%X (flags 0x%X), expected 0x%X (flags 0x%X)", op, v, c, bits, result, p->regs.flags, expected, expected_flags);
+      }
+   }
+
+   vxt_system_destroy(s);
+)
+
+#ifdef TESTING
+   // 8088 datasheet timing of the register form, and what the memory form adds. Memory operands
+   // are [BX], with an EA cost of 5. Shifts by CL use a count of 3.
+   struct test_timing {
+      vxt_byte opcode, reg;
+      int min, max, mem;
+   };
+
+   static const struct test_timing test_grp_cycles[] = {
+      {0xD0, 0, 2, 2, 13}, {0xD1, 0, 2, 2, 21}, {0xD2, 0, 20, 20, 12}, {0xD3, 0, 20, 20, 20},
+      {0xD0, 5, 2, 2, 13}, {0xD1, 7, 2, 2, 21}, {0xD2, 3, 20, 20, 12}, {0xD3, 4, 20, 20, 20},
+      {0xF6, 0, 5, 5, 6}, {0xF6, 2, 3, 3, 13}, {0xF6, 3, 3, 3, 13},
+      {0xF6, 4, 70, 77, 6}, {0xF6, 5, 80, 98, 6}, {0xF6, 6, 80, 90, 6}, {0xF6, 7, 101, 112, 6},
+      {0xF7, 0, 5, 5, 10}, {0xF7, 2, 3, 3, 21}, {0xF7, 3, 3, 3, 21},
+      {0xF7, 4, 118, 133, 10}, {0xF7, 5, 128, 154, 10}, {0xF7, 6, 144, 162, 10}, {0xF7, 7, 165, 184, 10}
+   };
+
+   static int test_step_cycles(CONSTSP(cpu) p, vxt_byte opcode, vxt_byte modregrm, const struct vxt_registers *regs, vxt_word data) {
+      const vxt_byte code[] = {opcode, modregrm, 0x01, 0x01};
+      for (int i = 0; i < (int)sizeof(code); i++) {
+         // Only changed bytes are written, so the decode cache can hit.
+         if (vxt_system_read_byte(p->s, 0xF000 + i) != code[i])
+            vxt_system_write_byte(p->s, 0xF000 + i, code[i]);
+      }
+      vxt_system_write_word(p->s, 0x404, data);
+
+      // Like cpu_reset, but keeps the decode cache.
+      flush_queue(p);
+      cpu_reset_cycle_count(p);
+      p->lazy.op = LAZY_NONE;
+      p->regs = *regs;
+      p->regs.ip = 0xF000;
+      p->regs.bx = 0x0404;
+      cpu_step(p);
+      cpu_update_flags(p);
+      return p->cycles;
+   }
+#endif
+
+// Shift, rotate and group 3 timing for register and memory operands with the same value. Then the
+// decode cache and lazy flags are checked against the instrumented path with random operands.
+TEST(grp_timing,
+   vxt_byte *mem;
+   CONSTP(vxt_system) s = test_machine_create(&mem, NULL, NULL, 0);
+   TENSURE(s);
+   CONSTSP(cpu) p = &s->cpu;
+
+   struct vxt_registers regs = {0};
+   regs.ax = 0x0123;
+   regs.cx = 3;
+   regs.flags = 2;
+
+   const int num = (int)(sizeof(test_grp_cycles) / sizeof(test_grp_cycles[0]));
+   for (int i = 0; i < num; i++) {
+      const struct test_timing *t = &test_grp_cycles[i];
+      const int reg = test_step_cycles(p, t->opcode, (vxt_byte)(0xC3 | (t->reg << 3)), &regs, 0x0404); // BL or BX
+      const int rm = test_step_cycles(p, t->opcode, (vxt_byte)(0x07 | (t->reg << 3)), &regs, 0x0404); // [BX]
+
+      TASSERT((reg >= t->min) && (reg <= t->max), "Opcode 0x%X/%d took %d cycles, expected %d-%d", t->opcode, t->reg, reg, t->min, t->max);
+      TASSERT(rm == reg + t->mem + 5, "Opcode 0x%X/%d with memory operand took %d cycles, expected %d", t->opcode, t->reg, rm, reg + t->mem + 5);
+   }
+
+   vxt_system_set_decode_cache(s, true);
+   vxt_dword seed = 1;
+
+   for (int i = 0; i < 20000; i++) {
+      const struct test_timing *t = &test_grp_cycles[test_rand(&seed) % num];
+      const vxt_byte modregrm = (vxt_byte)(((test_rand(&seed) & 1) ? 0xC3 : 0x07) | (t->reg << 3));
+      const vxt_word data = (vxt_word)test_rand(&seed);
+
+      regs.ax = (vxt_word)test_rand(&seed);
+      regs.cx = (vxt_word)test_rand(&seed) & 0x3F;
+      regs.dx = (vxt_word)test_rand(&seed) & 0xFF;
+      regs.flags = (vxt_word)(test_rand(&seed) & 0x8D5) | 2;
+
+      struct vxt_registers result;
+      vxt_word result_data = 0;
+      int cycles = 0;
+
+      // Instrumented, then twice through the decode cache.
+      for (int j = 0; j < 3; j++) {
+         p->tracer = j ? NULL : &test_tracer;
+         const int c = test_step_cycles(p, t->opcode, modregrm, &regs, data);
+         if (j) {
+            TASSERT(!memcmp(&result, &p->regs, sizeof(result)), "Registers differ! (opcode 0x%X/%d, pass %d)", t->opcode, t->reg, j);
+            TENSURE(vxt_system_read_word(s, 0x404) == result_data);
+            TENSURE(c == cycles);
+         }
+         result = p->regs;
+         result_data = vxt_system_read_word(s, 0x404);
+         cycles = c;
+      }
+   }
+
+   test_machine_destroy(s, mem);
+)
+
+#ifdef TESTING
+   static const vxt_byte test_smc_code[] = {
+      0x40,                         // INC AX (Patched to DEC AX)
+      0xE8, 0x3C, 0x00,             // CALL 0x140
+      0xC6, 0x06, 0x00, 0x01, 0x48, // MOV BYTE [0x100],0x48
+      0xBE, 0x00, 0x02,             // MOV SI,0x200
+      0xBF, 0x40, 0x01,             // MOV DI,0x140
+      0xB9, 0x02, 0x00,             // MOV CX,2
+      0xF3, 0xA4,                   // REP MOVSB
+      0xF4                          // HLT
+   };
+
+   // Lives at 0x140, in another code line than the caller.
+   static const vxt_byte test_smc_sub[] = {
+      0x81, 0xC2, 0x01, 0x00,       // ADD DX,1 (Patched to SUB DX,1)
+      0xC3                          // RET
+   };
+
+   static const vxt_byte test_smc_patch[] = {
+      0x81, 0xEA                    // SUB DX,imm16
+   };
+
+   // A live decoded instruction that no longer matches memory.
+   static bool test_stale_decode(vxt_system *s, const vxt_byte *mem, vxt_pointer addr) {
+      const struct decoded_inst *d = &s->cpu.decode_cache[addr & (DECODE_CACHE_SIZE - 1)];
+      return (d->addr == addr) && (d->gen == s->tables->code_gen[addr >> CODE_LINE_SHIFT]) && memcmp(d->bytes, &mem[addr], d->length);
+   }
+#endif
+
+// Code that rewrites itself, with a plain store and with REP MOVSB, and code that is replaced
+// by the host with vxt_system_write_block, must run the same with and without the decode cache.
+// The prefetch queue hides most stale decodes, so the cache entries are checked directly.
+TEST(decode_cache_invalidation,
+   struct vxt_registers result[2];
+   vxt_byte data[2][0x300];
+
+   for (int i = 0; i < 2; i++) {
+      vxt_byte *mem;
+      CONSTP(vxt_system) s = test_machine_create(&mem, NULL, test_smc_code, sizeof(test_smc_code));
+      TENSURE(s);
+      vxt_system_set_decode_cache(s, i != 0);
+      memcpy(&mem[0x140], test_smc_sub, sizeof(test_smc_sub));
+      memcpy(&mem[0x200], test_smc_patch, sizeof(test_smc_patch));
+
+      while (!s->cpu.halt)
+         TENSURE_NO_ERR(vxt_system_step(s, 1).err);
+      TENSURE((s->cpu.regs.ax == 1) && (s->cpu.regs.dx == 1));
+      TENSURE(!i || (!test_stale_decode(s, mem, 0x100) && !test_stale_decode(s, mem, 0x140)));
+
+      // Run the patched code.
+      s->cpu.halt = false;
+      s->cpu.regs.ip = 0x100;
+      flush_queue(&s->cpu);
+      while (!s->cpu.halt)
+         TENSURE_NO_ERR(vxt_system_step(s, 1).err);
+      TENSURE((s->cpu.regs.ax == 0) && (s->cpu.regs.dx == 0));
+
+      // Decode the DEC AX once more, then let the host turn it back into INC AX.
+      s->cpu.halt = false;
+      s->cpu.regs.ip = 0x100;
+      flush_queue(&s->cpu);
+      TENSURE_NO_ERR(vxt_system_step(s, 1).err);
+      TENSURE(s->cpu.regs.ax == 0xFFFF);
+
+      const vxt_byte inc_ax = 0x40;
+      vxt_system_write_block(s, 0x100, &inc_ax, 1);
+      TENSURE(!i || !test_stale_decode(s, mem, 0x100));
+
+      s->cpu.regs.ip = 0x100;
+      flush_queue(&s->cpu);
+      while (!s->cpu.halt)
+         TENSURE_NO_ERR(vxt_system_step(s, 1).err);
+      TENSURE((s->cpu.regs.ax == 0) && (s->cpu.regs.dx == 0xFFFF));
+
+      result[i] = s->cpu.regs;
+      memcpy(data[i], mem, sizeof(data[i]));
+      test_machine_destroy(s, mem);
+   }
+
+   TENSURE(!memcmp(&result[0], &result[1], sizeof(struct vxt_registers)));
+   TENSURE(!memcmp(data[0], data[1], sizeof(data[0])));
+)
+
+// SCAS writes the flags directly, so a pending lazy result from an earlier instruction must not override them.
+TEST(lazy_flags_scas,
+   vxt_byte *mem;
+   CONSTP(vxt_system) s = test_machine_create(&mem, NULL, test_scas_code, sizeof(test_scas_code));
+   TENSURE(s);
+   memcpy(&mem[0x300], "Babc", 4);
+
+   vxt_system_step(s, 60);
+   TENSURE(s->cpu.halt && (s->cpu.regs.ip == 0x10D) && (s->cpu.regs.al == 0x43));
+
+   s->cpu.halt = false;
+   s->cpu.regs.ax = 0;
+   s->cpu.regs.ip = 0x120;
+   vxt_system_step(s, 200);
+   TENSURE(s->cpu.halt && (s->cpu.regs.ip == 0x12E) && (s->cpu.regs.al == 0) && (s->cpu.regs.cx == 0));
+
+   test_machine_destroy(s, mem);
+)
+
+// Runs a small 8087 program and checks rounding, conversions and the register stack.
+TEST(fpu_program,
+   vxt_byte *mem;
+   CONSTP(vxt_system) s = test_machine_create(&mem, NULL, test_fpu_code, sizeof(test_fpu_code));
+   TENSURE(s);
+   vxt_system_set_fpu(s, true);
+
+   CONSTSP(cpu) p = &s->cpu;
+   const double half = 2.5;
+   const double negative = -2.7;
+
+   mem[0x200] = 7;
+   mem[0x206] = 0xFF;
+   mem[0x207] = 0x0F; // Round toward zero
+   memcpy(&mem[0x210], &half, 8);
+   memcpy(&mem[0x218], &negative, 8);
+
+   while (p->regs.ip < 0x100 + sizeof(test_fpu_code))
+      cpu_step(p);
+
+   TENSURE(WORD(mem[0x203], mem[0x202]) == 25);     // 8 * pi
+   TENSURE(WORD(mem[0x205], mem[0x204]) == 2);      // Nearest or even
+   TENSURE(WORD(mem[0x209], mem[0x208]) == 0xFFFE); // Truncated
+   TENSURE(mem[0x230] == 0x21 && mem[0x239] == 0);  // 7 * pi as BCD
+   TENSURE((WORD(mem[0x20B], mem[0x20A]) & 0x4500) == 0x4000);
+   TENSURE(p->fpu.tag == 0xFFFF);
+
+   test_machine_destroy(s, mem);
+)
+
+#ifdef TESTING
+   static const vxt_byte test_fsave_code[] = {
+      0xDB, 0xE3,             // FINIT
+      0xD9, 0xE8,             // FLD1
+      0xD9, 0xEB,             // FLDPI
+      0xDD, 0x36, 0x00, 0x03, // FSAVE [0x300]
+      0xDD, 0x3E, 0x80, 0x03, // FSTSW [0x380]
+      0xDD, 0x26, 0x00, 0x03, // FRSTOR [0x300]
+      0xDD, 0x3E, 0x82, 0x03  // FSTSW [0x382]
+   };
+
+   static const vxt_byte test_fprem_code[] = {
+      0xDB, 0xE3,             // FINIT
+      0xDF, 0x06, 0x00, 0x02, // FILD WORD [0x200]
+      0xDF, 0x06, 0x02, 0x02, // FILD WORD [0x202]
+      0xD9, 0xF8,             // FPREM
+      0xDD, 0x3E, 0x10, 0x02, // FSTSW [0x210]
+      0xDF, 0x1E, 0x12, 0x02, // FISTP WORD [0x212]
+      0xDB, 0xE3,             // FINIT
+      0xDF, 0x06, 0x06, 0x02, // FILD WORD [0x206]
+      0xDF, 0x06, 0x04, 0x02, // FILD WORD [0x204]
+      0xD9, 0xF8,             // FPREM
+      0xDD, 0x3E, 0x14, 0x02, // FSTSW [0x214]
+      0xDF, 0x1E, 0x16, 0x02  // FISTP WORD [0x216]
+   };
+
+   static const vxt_byte test_fpu_stack_code[] = {
+      0xDB, 0xE3,             // FINIT
+      0xD9, 0xE8, 0xD9, 0xE8, // FLD1 x8
+      0xD9, 0xE8, 0xD9, 0xE8,
+      0xD9, 0xE8, 0xD9, 0xE8,
+      0xD9, 0xE8, 0xD9, 0xE8,
+      0xDD, 0x3E, 0x20, 0x02, // FSTSW [0x220]
+      0xD9, 0xE8,             // FLD1
+      0xDD, 0x3E, 0x22, 0x02, // FSTSW [0x222]
+      0xDB, 0xE3,             // FINIT
+      0xDD, 0x16, 0x30, 0x02, // FST QWORD [0x230]
+      0xDD, 0x3E, 0x24, 0x02  // FSTSW [0x224]
+   };
+
+   static const vxt_byte test_fpu_indefinite[8] = {0, 0, 0, 0, 0, 0, 0xF8, 0xFF};
+#endif
+
+// FSAVE stores the environment followed by ST(0)-ST(7) as 80-bit reals, and then initializes the FPU.
+TEST(fpu_save_layout,
+   vxt_byte *mem;
+   CONSTP(vxt_system) s = test_machine_create(&mem, NULL, test_fsave_code, sizeof(test_fsave_code));
+   TENSURE(s);
+   vxt_system_set_fpu(s, true);
+
+   CONSTSP(cpu) p = &s->cpu;
+   while (p->regs.ip < 0x100 + sizeof(test_fsave_code))
+      cpu_step(p);
+
+   const vxt_byte *env = &mem[0x300];
+   TENSURE(WORD(env[1], env[0]) == 0x3FF);    // Control
+   TENSURE(WORD(env[3], env[2]) == 0x3000);   // Status with TOP = 6
+   TENSURE(WORD(env[5], env[4]) == 0x0FFF);   // Tags
+   TENSURE(WORD(env[7], env[6]) == 0x104);    // FLDPI
+   TENSURE(WORD(env[9], env[8]) == 0x1EB);    // D9 EB
+   TENSURE(WORD(env[11], env[10]) == 0 && WORD(env[13], env[12]) == 0);
+
+   const vxt_byte *st0 = &env[14];
+   const vxt_byte *st1 = &env[24];
+   TENSURE(st0[7] == 0xC9 && st0[8] == 0x00 && st0[9] == 0x40); // Pi
+   for (int i = 0; i < 7; i++)
+      TENSURE(st1[i] == 0);
+   TENSURE(st1[7] == 0x80 && st1[8] == 0xFF && st1[9] == 0x3F); // 1.0
+
+   TENSURE(WORD(mem[0x381], mem[0x380]) == 0);
+   TENSURE(WORD(mem[0x383], mem[0x382]) == 0x3000);
+   TENSURE(p->fpu.tag == 0x0FFF && p->fpu.control == 0x3FF);
+   TENSURE(p->fpu.regs[7] == 1.0L);
+
+   test_machine_destroy(s, mem);
+)
+
+// FPREM stores the three low bits of the quotient in C0, C3 and C1. C2 is clear when the reduction is complete.
+TEST(fpu_prem,
+   vxt_byte *mem;
+   CONSTP(vxt_system) s = test_machine_create(&mem, NULL, test_fprem_code, sizeof(test_fprem_code));
+   TENSURE(s);
+   vxt_system_set_fpu(s, true);
+
+   mem[0x200] = 5;
+   mem[0x202] = 17;
+   mem[0x204] = 0xE9; mem[0x205] = 0xFF; // -23
+   mem[0x206] = 4;
+
+   CONSTSP(cpu) p = &s->cpu;
+   while (p->regs.ip < 0x100 + sizeof(test_fprem_code))
+      cpu_step(p);
+
+   TENSURE((WORD(mem[0x211], mem[0x210]) & 0x4700) == 0x4200); // Quotient 3
+   TENSURE(WORD(mem[0x213], mem[0x212]) == 2);
+   TENSURE((WORD(mem[0x215], mem[0x214]) & 0x4700) == 0x0300); // Quotient -5
+   TENSURE(WORD(mem[0x217], mem[0x216]) == 0xFFFD);
+
+   test_machine_destroy(s, mem);
+)
+
+// Pushing onto a full stack, or reading an empty register, is an invalid operation that produces the indefinite value.
+TEST(fpu_stack,
+   vxt_byte *mem;
+   CONSTP(vxt_system) s = test_machine_create(&mem, NULL, test_fpu_stack_code, sizeof(test_fpu_stack_code));
+   TENSURE(s);
+   vxt_system_set_fpu(s, true);
+
+   CONSTSP(cpu) p = &s->cpu;
+   while (p->regs.ip < 0x100 + sizeof(test_fpu_stack_code))
+      cpu_step(p);
+
+   TENSURE((WORD(mem[0x221], mem[0x220]) & FPU_EXCEPTIONS) == 0);
+   TENSURE((WORD(mem[0x223], mem[0x222]) & (FPU_EXCEPTIONS | FPU_ES)) == FPU_IE); // Overflow, masked
+   TENSURE((WORD(mem[0x225], mem[0x224]) & (FPU_EXCEPTIONS | FPU_ES)) == FPU_IE); // Underflow, masked
+   TENSURE(!memcmp(&mem[0x230], test_fpu_indefinite, 8));
+   TENSURE(!p->nmi_pending);
+
+   test_machine_destroy(s, mem);
+)
+
+#endif
@@ -24,57 +24,168 @@
 
 #include "common.h"
 
-// TODO: This need some more work.
-#if !defined(VXT_NO_PREFETCH) && defined(PI8088)
-   #define VXT_NO_PREFETCH
-#endif
-
 #ifndef VXT_NO_PREFETCH
    //#define VXT_DEBUG_PREFETCH
 #endif
 
-#define VALIDATOR_BEGIN(p, regs) { if ((p)->validator) (p)->validator->begin((regs), (p)->validator->userdata); }
-#define VALIDATOR_END(p, name, op, mod, cycles, regs) { if ((p)->validator) (p)->validator->end((name), (op), (mod), (cycles), (regs), (p)->validator->userdata); }
-#define VALIDATOR_READ(p, addr, data) { if ((p)->validator) (p)->validator->read((addr), (data), (p)->validator->userdata); }
-#define VALIDATOR_WRITE(p, addr, data) { if ((p)->validator) (p)->validator->write((addr), (data), (p)->validator->userdata); }
-#define VALIDATOR_DISCARD(p) { if ((p)->validator) (p)->validator->discard((p)->validator->userdata); }
+// The FPU needs the host math library.
+#if defined(VXT_NO_LIBC) && !defined(VXT_NO_FPU)
+   #define VXT_NO_FPU
+#endif
+
+// VXT_CPU_FAST is defined by cpu_fast.c, which builds the core without instrumentation.
+#ifdef VXT_CPU_FAST
+   #define CPU_INSTRUMENTED(p) false
+   #define VALIDATOR_BEGIN(p, regs)
+   #define VALIDATOR_END(p, name, op, mod, cycles, regs)
+   #define VALIDATOR_READ(p, addr, data)
+   #define VALIDATOR_WRITE(p, addr, data)
+   #define VALIDATOR_DISCARD(p)
+#else
+   #define CPU_INSTRUMENTED(p) ((p)->tracer || (p)->validator)
+   #define VALIDATOR_BEGIN(p, regs) { if ((p)->validator) (p)->validator->begin((regs), (p)->validator->userdata); }
+   #define VALIDATOR_END(p, name, op, mod, cycles, regs) { if ((p)->validator) (p)->validator->end((name), (op), (mod), (cycles), (regs), (p)->validator->userdata); }
+   #define VALIDATOR_READ(p, addr, data) { if ((p)->validator) (p)->validator->read((addr), (data), (p)->validator->userdata); }
+   #define VALIDATOR_WRITE(p, addr, data) { if ((p)->validator) (p)->validator->write((addr), (data), (p)->validator->userdata); }
+   #define VALIDATOR_DISCARD(p) { if ((p)->validator) (p)->validator->discard((p)->validator->userdata); }
+#endif
 
 struct address_mode {
    vxt_byte mod, reg, rm;
+   vxt_byte modregrm;
    vxt_word disp;
 };
 
+// Operands of the last ALU operation whose flags have not yet been written to regs.flags.
+struct lazy_flags {
+   int op;
+   vxt_word a, b, c;
+};
+
+#define DECODE_CACHE_SIZE 4096
+#define DECODE_MAX_BYTES 8
+
+// Result of the prefix, opcode and ModR/M decode for one instruction.
+struct decoded_inst {
+   vxt_pointer addr;
+   unsigned int gen;
+   const struct instruction *inst;
+   struct address_mode mode;
+   vxt_byte opcode, repeat;
+   vxt_byte seg_override, seg_reg;
+   vxt_byte length, cycles;
+   vxt_byte bytes[DECODE_MAX_BYTES];
+};
+
+// Open addressed table of instruction addresses. It is never filled more than 3/4.
+#define PROFILER_SIZE 0x2000
+#define PROFILER_BITS 13
+#define PROFILER_STACK 64
+
+// Shadow call stack entry. A frame is popped when the stack pointer moves above the return address.
+struct profile_frame {
+   vxt_pointer addr;
+   vxt_word ss, sp;
+};
+
+struct profiler {
+   unsigned long long dropped;
+   int num_addresses;
+   struct vxt_profile_entry opcodes[0x100];
+   struct vxt_profile_entry addresses[PROFILER_SIZE];
+
+   vxt_pointer next;
+   int depth;
+   struct profile_frame stack[PROFILER_STACK];
+};
+
+// The queue is a ring buffer. Only INST_QUEUE_SIZE bytes are used.
+#define INST_QUEUE_SIZE 6
+#define INST_QUEUE_MASK 7
+
+// Clocks per transfer on the 8-bit bus.
+#define BUS_CYCLE 4
+
+struct dispatch {
+   const struct instruction *inst;
+   bool invalid;
+};
+
+// 8087 state. Registers are stored in physical order and ST(0) is at TOP.
+struct fpu {
+   long double regs[8];
+   vxt_word control, status, tag;
+   vxt_word opcode;
+   vxt_pointer ip, dp;
+};
+
+// The fields used by every instruction come first, so they share as few cache lines as possible.
 struct cpu {
    struct vxt_registers regs;
    bool trap, halt, invalid;
    bool interrupt, int28;
+
+   // Set by the PIC when it has an unmasked request that is not in service.
+   bool irq_pending;
+
+   // The NMI input is the 8087 interrupt gated by the NMI mask register.
+   bool nmi_enabled, fpu_int, nmi_pending;
+
    int cycles;
-   
    vxt_word inst_start;
-   const struct instruction *inst;
 
    vxt_byte opcode, repeat;
-   struct address_mode mode;
-
    vxt_word seg;
    vxt_byte seg_override;
+   struct address_mode mode;
+   const struct instruction *inst;
 
-   int bus_transfers;
+   struct lazy_flags lazy;
 
+   int bus_transfers;
    bool inst_queue_dirty;
-   int inst_queue_count;
-   vxt_byte inst_queue[6];
-   vxt_pointer inst_queue_debug[6];
+   int inst_queue_head, inst_queue_count;
+   int biu_cycles;
+   vxt_byte inst_queue[INST_QUEUE_MASK + 1];
+
+   bool use_decode_cache;
+   bool has_fpu;
+
+   // Signature of the memory writes since the last idle loop check. Writes that are
+   // not part of the signature, like OUT and bulk string writes, set side_effect.
+   bool side_effect;
+   vxt_dword write_hash;
 
    void (*tracer)(vxt_system*,vxt_pointer,vxt_byte);
    const struct vxt_validator *validator;
    struct vxt_peripheral *pic;
    vxt_system *s;
+
+   // Allocated separately. It is only used with vxt_system_set_decode_cache.
+   struct decoded_inst *decode_cache;
+
+   // Counts are kept when profiling is stopped so they can be read afterwards.
+   bool profiling;
+   struct profiler *profiler;
+
+   // Opcode tables for the selected CPU model. One for each variant of the core.
+   struct dispatch dispatch[0x100];
+   struct dispatch dispatch_fast[0x100];
+
+   vxt_pointer inst_queue_debug[INST_QUEUE_MASK + 1];
+   struct fpu fpu;
 };
 
 void cpu_reset(CONSTSP(cpu) p);
+void cpu_set_model(CONSTSP(cpu) p, enum vxt_cpu_model model);
+void cpu_fast_set_model(CONSTSP(cpu) p, enum vxt_cpu_model model);
 void cpu_reset_cycle_count(CONSTSP(cpu) p);
+void cpu_flush_decode_cache(CONSTSP(cpu) p);
+void cpu_update_nmi(CONSTSP(cpu) p, bool enabled, bool fpu_int);
+void cpu_update_flags(CONSTSP(cpu) p);
+void cpu_clear_profiler(CONSTSP(cpu) p);
 int cpu_step(CONSTSP(cpu) p);
+int cpu_step_fast(CONSTSP(cpu) p);
 
 vxt_word cpu_segment_read_byte(CONSTSP(cpu) p, vxt_word segment, vxt_word offset);
 vxt_word cpu_segment_read_word(CONSTSP(cpu) p, vxt_word segment, vxt_word offset);
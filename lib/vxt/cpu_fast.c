@@ -0,0 +1,40 @@
+// Copyright (c) 2019-2024 Andreas T Jonsson <mail@andreasjonsson.se>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+//
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any source
+//    distribution.
+
+
+// The CPU core from cpu.c built a second time, without validator, tracer and
+// debug checks. vxt_system_step uses it unless a validator or tracer is installed.
+
+#define VXT_CPU_FAST
+
+#define cpu_step cpu_step_fast
+#define cpu_set_model cpu_fast_set_model
+#define cpu_segment_read_byte cpu_fast_segment_read_byte
+#define cpu_segment_read_word cpu_fast_segment_read_word
+#define cpu_segment_write_byte cpu_fast_segment_write_byte
+#define cpu_segment_write_word cpu_fast_segment_write_word
+
+#include "common.h"
+
+#undef ENSURE
+#define ENSURE(e) {}
+
+#include "cpu.c"
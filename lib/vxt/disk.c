@@ -71,14 +71,13 @@ static vxt_byte execute_operation(vxt_system *s, struct disk *c, vxt_byte disk,
         if (read) {
             if (di->read(s, dev->fp, dev->buffer, SECTOR_SIZE) != SECTOR_SIZE)
                 break;
-            for (int i = 0; i < SECTOR_SIZE; i++)
-                vxt_system_write_byte(s, addr++, dev->buffer[i]);
+            vxt_system_write_block(s, addr, dev->buffer, SECTOR_SIZE);
         } else {
-            for (int i = 0; i < SECTOR_SIZE; i++)
-                dev->buffer[i] = vxt_system_read_byte(s, addr++);
+            vxt_system_read_block(s, addr, dev->buffer, SECTOR_SIZE);
             if (di->write(s, dev->fp, dev->buffer, SECTOR_SIZE) != SECTOR_SIZE)
                 break;
         }
+        addr += SECTOR_SIZE;
         num_sectors++;
     }
 
@@ -27,7 +27,13 @@
 #include "cpu.h"
 #include "flags.h"
 
-#define TRACE(p, ip, data) { if ((p)->tracer) (p)->tracer((p)->s, VXT_POINTER((p)->regs.cs, (ip)), (data)); }
+#include <stddef.h>
+
+#ifdef VXT_CPU_FAST
+   #define TRACE(p, ip, data)
+#else
+   #define TRACE(p, ip, data) { if ((p)->tracer) (p)->tracer((p)->s, VXT_POINTER((p)->regs.cs, (ip)), (data)); }
+#endif
 #define MOD_TARGET_MEM(mode) ((mode).mod < 3)
 
 enum architecture {
@@ -61,17 +67,21 @@ static vxt_byte read_opcode8(CONSTSP(cpu) p) {
    vxt_word ip = p->regs.ip;
    
    if (p->inst_queue_count > 0) {
-      data = *p->inst_queue;
-      memmove(p->inst_queue, &p->inst_queue[1], --p->inst_queue_count);
+      data = p->inst_queue[p->inst_queue_head];
 
       #if defined(VXT_DEBUG_PREFETCH) && !defined(VXT_NO_PREFETCH)
          vxt_pointer ptr = VXT_POINTER(p->regs.cs, ip);
-         if (*p->inst_queue_debug != ptr) {
-            VXT_LOG("FATAL: Broken prefetch queue detected! Expected 0x%X but got 0x%X.", *p->inst_queue_debug, ptr);
+         if (p->inst_queue_debug[p->inst_queue_head] != ptr) {
+            VXT_LOG("FATAL: Broken prefetch queue detected! Expected 0x%X but got 0x%X.", p->inst_queue_debug[p->inst_queue_head], ptr);
             p->regs.debug = true;
          }
-         memmove(p->inst_queue_debug, &p->inst_queue_debug[1], p->inst_queue_count * sizeof(vxt_pointer));
       #endif
+
+      p->inst_queue_head = (p->inst_queue_head + 1) & INST_QUEUE_MASK;
+      p->inst_queue_count--;
+
+      // The validator expects to see every opcode fetch.
+      VALIDATOR_READ(p, VXT_POINTER(p->regs.cs, ip), data);
    } else {
       data = cpu_segment_read_byte(p, p->regs.cs, ip);
    }
@@ -87,128 +97,83 @@ static vxt_word read_opcode16(CONSTSP(cpu) p) {
    return WORD(h, l);
 }
 
+static vxt_word ea_bx_si(CONSTSP(vxt_registers) r, vxt_word disp) { return r->bx + r->si + disp; }
+static vxt_word ea_bx_di(CONSTSP(vxt_registers) r, vxt_word disp) { return r->bx + r->di + disp; }
+static vxt_word ea_bp_si(CONSTSP(vxt_registers) r, vxt_word disp) { return r->bp + r->si + disp; }
+static vxt_word ea_bp_di(CONSTSP(vxt_registers) r, vxt_word disp) { return r->bp + r->di + disp; }
+static vxt_word ea_si(CONSTSP(vxt_registers) r, vxt_word disp) { return r->si + disp; }
+static vxt_word ea_di(CONSTSP(vxt_registers) r, vxt_word disp) { return r->di + disp; }
+static vxt_word ea_bp(CONSTSP(vxt_registers) r, vxt_word disp) { return r->bp + disp; }
+static vxt_word ea_bx(CONSTSP(vxt_registers) r, vxt_word disp) { return r->bx + disp; }
+static vxt_word ea_disp(CONSTSP(vxt_registers) r, vxt_word disp) { UNUSED(r); return disp; }
+static vxt_word ea_reg(CONSTSP(vxt_registers) r, vxt_word disp) { UNUSED(r); UNUSED(disp); UNREACHABLE(0); }
+
+// Everything about a ModR/M byte that does not depend on the following bytes.
+struct modregrm {
+   vxt_byte mod, reg, rm;
+   vxt_byte disp_size;
+   bool use_ss;
+   vxt_byte cycles; // Effective address calculation on the 8088.
+   vxt_word (*ea)(CONSTSP(vxt_registers), vxt_word);
+};
+
+#define MRM(mod, reg, rm, disp, ss, c, ea) { (mod), (reg), (rm), (disp), (ss), (c), (ea) }
+#define MRM_MEM(mod, reg, disp, c)                                                                  \
+   MRM(mod, reg, 0, disp, false, 7 + (c), &ea_bx_si), MRM(mod, reg, 1, disp, false, 8 + (c), &ea_bx_di), \
+   MRM(mod, reg, 2, disp, true, 8 + (c), &ea_bp_si), MRM(mod, reg, 3, disp, true, 7 + (c), &ea_bp_di),   \
+   MRM(mod, reg, 4, disp, false, 5 + (c), &ea_si), MRM(mod, reg, 5, disp, false, 5 + (c), &ea_di)
+#define MRM_MOD0(reg) MRM_MEM(0, reg, 0, 0), MRM(0, reg, 6, 2, false, 6, &ea_disp), MRM(0, reg, 7, 0, false, 5, &ea_bx)
+#define MRM_MOD12(mod, reg) MRM_MEM(mod, reg, mod, 4), MRM(mod, reg, 6, mod, true, 9, &ea_bp), MRM(mod, reg, 7, mod, false, 9, &ea_bx)
+#define MRM_MOD3(reg)                                                                              \
+   MRM(3, reg, 0, 0, false, 0, &ea_reg), MRM(3, reg, 1, 0, false, 0, &ea_reg), MRM(3, reg, 2, 0, false, 0, &ea_reg), \
+   MRM(3, reg, 3, 0, false, 0, &ea_reg), MRM(3, reg, 4, 0, false, 0, &ea_reg), MRM(3, reg, 5, 0, false, 0, &ea_reg), \
+   MRM(3, reg, 6, 0, false, 0, &ea_reg), MRM(3, reg, 7, 0, false, 0, &ea_reg)
+
+static const struct modregrm modregrm_table[0x100] = {
+   MRM_MOD0(0), MRM_MOD0(1), MRM_MOD0(2), MRM_MOD0(3), MRM_MOD0(4), MRM_MOD0(5), MRM_MOD0(6), MRM_MOD0(7),
+   MRM_MOD12(1, 0), MRM_MOD12(1, 1), MRM_MOD12(1, 2), MRM_MOD12(1, 3), MRM_MOD12(1, 4), MRM_MOD12(1, 5), MRM_MOD12(1, 6), MRM_MOD12(1, 7),
+   MRM_MOD12(2, 0), MRM_MOD12(2, 1), MRM_MOD12(2, 2), MRM_MOD12(2, 3), MRM_MOD12(2, 4), MRM_MOD12(2, 5), MRM_MOD12(2, 6), MRM_MOD12(2, 7),
+   MRM_MOD3(0), MRM_MOD3(1), MRM_MOD3(2), MRM_MOD3(3), MRM_MOD3(4), MRM_MOD3(5), MRM_MOD3(6), MRM_MOD3(7)
+};
+
+#undef MRM_MOD3
+#undef MRM_MOD12
+#undef MRM_MOD0
+#undef MRM_MEM
+#undef MRM
+
 static vxt_word get_ea_offset(CONSTSP(cpu) p) {
-   CONSTSP(vxt_registers) r = &p->regs;
-   CONSTSP(address_mode) m = &p->mode;
-
-	switch (m->mod) {
-      case 0:
-         switch (m->rm) {
-            case 0: return r->bx + r->si;
-            case 1: return r->bx + r->di;
-            case 2: return r->bp + r->si;
-            case 3: return r->bp + r->di;
-            case 4: return r->si;
-            case 5: return r->di;
-            case 6: return m->disp;
-            case 7: return r->bx;
-         }
-         break;
-      case 1:
-      case 2:
-         switch (m->rm) {
-            case 0: return r->bx + r->si + m->disp;
-            case 1: return r->bx + r->di + m->disp;
-            case 2: return r->bp + r->si + m->disp;
-            case 3: return r->bp + r->di + m->disp;
-            case 4: return r->si + m->disp;
-            case 5: return r->di + m->disp;
-            case 6: return r->bp + m->disp;
-            case 7: return r->bx + m->disp;
-         }
-         break;
-	}
-	UNREACHABLE(0);
+   return modregrm_table[p->mode.modregrm].ea(&p->regs, p->mode.disp);
 }
 
+// Byte offsets into the register file in ModR/M order.
+static const vxt_byte reg8_offset[8] = {
+   offsetof(struct vxt_registers, al), offsetof(struct vxt_registers, cl), offsetof(struct vxt_registers, dl), offsetof(struct vxt_registers, bl),
+   offsetof(struct vxt_registers, ah), offsetof(struct vxt_registers, ch), offsetof(struct vxt_registers, dh), offsetof(struct vxt_registers, bh)
+};
+
+static const vxt_byte reg16_offset[8] = {
+   offsetof(struct vxt_registers, ax), offsetof(struct vxt_registers, cx), offsetof(struct vxt_registers, dx), offsetof(struct vxt_registers, bx),
+   offsetof(struct vxt_registers, sp), offsetof(struct vxt_registers, bp), offsetof(struct vxt_registers, si), offsetof(struct vxt_registers, di)
+};
+
 static vxt_byte reg_read8(CONSTSP(vxt_registers) r, int reg) {
-   switch (reg) {
-      case 0: return r->al;
-      case 1: return r->cl;
-      case 2: return r->dl;
-      case 3: return r->bl;
-      case 4: return r->ah;
-      case 5: return r->ch;
-      case 6: return r->dh;
-      case 7: return r->bh;
-      default: UNREACHABLE(0);
-   }
+   return ((const vxt_byte*)r)[reg8_offset[reg & 7]];
 }
 
 static vxt_word reg_read16(CONSTSP(vxt_registers) r, int reg) {
-   switch (reg) {
-      case 0: return r->ax;
-      case 1: return r->cx;
-      case 2: return r->dx;
-      case 3: return r->bx;
-      case 4: return r->sp;
-      case 5: return r->bp;
-      case 6: return r->si;
-      case 7: return r->di;
-      default: UNREACHABLE(0);
-   }
+   const vxt_byte *ptr = (const vxt_byte*)r + reg16_offset[reg & 7];
+   return WORD(ptr[1], ptr[0]);
 }
 
 static void reg_write8(CONSTSP(vxt_registers) r, int reg, vxt_byte data) {
-   switch (reg) {
-      case 0:
-         r->al = data;
-         return;
-      case 1:
-         r->cl = data;
-         return;
-      case 2:
-         r->dl = data;
-         return;
-      case 3:
-         r->bl = data;
-         return;
-      case 4:
-         r->ah = data;
-         return;
-      case 5:
-         r->ch = data;
-         return;
-      case 6:
-         r->dh = data;
-         return;
-      case 7:
-         r->bh = data;
-         return;
-      default:
-         UNREACHABLE();
-   }
+   ((vxt_byte*)r)[reg8_offset[reg & 7]] = data;
 }
 
 static void reg_write16(CONSTSP(vxt_registers) r, int reg, vxt_word data) {
-   switch (reg) {
-      case 0:
-         r->ax = data;
-         return;
-      case 1:
-         r->cx = data;
-         return;
-      case 2:
-         r->dx = data;
-         return;
-      case 3:
-         r->bx = data;
-         return;
-      case 4:
-         r->sp = data;
-         return;
-      case 5:
-         r->bp = data;
-         return;
-      case 6:
-         r->si = data;
-         return;
-      case 7:
-         r->di = data;
-         return;
-      default:
-         UNREACHABLE();
-   }
+   vxt_byte *ptr = (vxt_byte*)r + reg16_offset[reg & 7];
+   ptr[0] = LBYTE(data);
+   ptr[1] = HBYTE(data);
 }
 
 static vxt_word seg_read16(CONSTSP(cpu) p) {
@@ -304,36 +269,26 @@ static void override_with_ss(CONSTSP(cpu) p, bool cond) {
 }
 
 static vxt_byte read_modregrm(CONSTSP(cpu) p) {
-   vxt_byte modregrm = read_opcode8(p);
-   struct address_mode mode = {
-      .mod = modregrm >> 6,
-      .reg = (modregrm >> 3) & 7,
-      .rm = modregrm & 7,
-      .disp = 0
-   };
-
-	switch(mode.mod) {
-	   case 0:
-	      if (mode.rm == 6)
-	         mode.disp = read_opcode16(p);
-         override_with_ss(p, (mode.rm == 2) || (mode.rm == 3));
-	      break;
-	   case 1:
-	      mode.disp = sign_extend16(read_opcode8(p));
-         override_with_ss(p, (mode.rm == 2) || (mode.rm == 3) || (mode.rm == 6));
-	      break;
-	   case 2:
-	      mode.disp = read_opcode16(p);
-	      override_with_ss(p, (mode.rm == 2) || (mode.rm == 3) || (mode.rm == 6));
-	      break;
-	}
-
-   p->mode = mode;
+   const vxt_byte modregrm = read_opcode8(p);
+   const struct modregrm *m = &modregrm_table[modregrm];
+
+   vxt_word disp = 0;
+   if (m->disp_size == 1)
+      disp = sign_extend16(read_opcode8(p));
+   else if (m->disp_size == 2)
+      disp = read_opcode16(p);
+
+   // The instruction table only holds the register form timing. Memory operands add the effective address calculation.
+   p->cycles += m->cycles;
+
+   override_with_ss(p, m->use_ss);
+   p->mode = (struct address_mode){ m->mod, m->reg, m->rm, modregrm, disp };
    return modregrm;
 }
 
 static void call_int(CONSTSP(cpu) p, int n) {
 	VALIDATOR_DISCARD(p);
+	flags_materialize(p);
 	CONSTSP(vxt_registers) r = &p->regs;
 	
 	vxt_word flags = (r->flags & ALL_FLAGS) | 2;
@@ -355,6 +310,23 @@ static void call_int(CONSTSP(cpu) p, int n) {
 		p->int28 = true;
 }
 
+// The multiply and divide microcode loops take an extra cycle for each set bit.
+static int bit_count(vxt_word v) {
+   v = v - ((v >> 1) & 0x5555);
+   v = (v & 0x3333) + ((v >> 2) & 0x3333);
+   v = (v + (v >> 4)) & 0x0F0F;
+   return (v + (v >> 8)) & 0x1F;
+}
+
+// Timing of instructions where the memory form takes longer than the register form, not counting the EA.
+static int rm_cycles(CONSTSP(cpu) p, int reg, int mem) {
+   return (p->mode.mod == 3) ? reg : mem;
+}
+
+static vxt_word abs16(vxt_int16 v) {
+   return (vxt_word)((v < 0) ? -v : v);
+}
+
 static void div_zero(CONSTSP(cpu) p) {
 	#ifndef TESTING
 		// 8088 do not do this.
@@ -24,31 +24,32 @@
 
 #include "shift.inl"
 #include "rep.inl"
+#include "fpu.inl"
 
 #define CARRY (((p->inst->opcode > 0xF) && (p->regs.flags & VXT_CARRY)) ? 1 : 0)
 
 static void add_0_10(CONSTSP(cpu) p) {
-   rm_write8(p, op_add_adc8(&p->regs, rm_read8(p), reg_read8(&p->regs, p->mode.reg), CARRY));
+   rm_write8(p, lazy_add_adc8(p, rm_read8(p), reg_read8(&p->regs, p->mode.reg), CARRY));
 }
 
 static void add_1_11(CONSTSP(cpu) p) {
-   rm_write16(p, op_add_adc16(&p->regs, rm_read16(p), reg_read16(&p->regs, p->mode.reg), CARRY));
+   rm_write16(p, lazy_add_adc16(p, rm_read16(p), reg_read16(&p->regs, p->mode.reg), CARRY));
 }
 
 static void add_2_12(CONSTSP(cpu) p) {
-   reg_write8(&p->regs, p->mode.reg, op_add_adc8(&p->regs, reg_read8(&p->regs, p->mode.reg), rm_read8(p), CARRY));
+   reg_write8(&p->regs, p->mode.reg, lazy_add_adc8(p, reg_read8(&p->regs, p->mode.reg), rm_read8(p), CARRY));
 }
 
 static void add_3_13(CONSTSP(cpu) p) {
-   reg_write16(&p->regs, p->mode.reg, op_add_adc16(&p->regs, reg_read16(&p->regs, p->mode.reg), rm_read16(p), CARRY));
+   reg_write16(&p->regs, p->mode.reg, lazy_add_adc16(p, reg_read16(&p->regs, p->mode.reg), rm_read16(p), CARRY));
 }
 
 static void add_4_14(CONSTSP(cpu) p) {
-   p->regs.al = op_add_adc8(&p->regs, p->regs.al, read_opcode8(p), CARRY);
+   p->regs.al = lazy_add_adc8(p, p->regs.al, read_opcode8(p), CARRY);
 }
 
 static void add_5_15(CONSTSP(cpu) p) {
-   p->regs.ax = op_add_adc16(&p->regs, p->regs.ax, read_opcode16(p), CARRY);
+   p->regs.ax = lazy_add_adc16(p, p->regs.ax, read_opcode16(p), CARRY);
 }
 
 #undef CARRY
@@ -95,32 +96,32 @@ static void push_cs(CONSTSP(cpu) p) {
 }
 
 static void or_8(CONSTSP(cpu) p) {
-   rm_write8(p, op_or8(&p->regs, rm_read8(p), reg_read8(&p->regs, p->mode.reg)));
+   rm_write8(p, lazy_or8(p, rm_read8(p), reg_read8(&p->regs, p->mode.reg)));
 }
 
 static void or_9(CONSTSP(cpu) p) {
-   rm_write16(p, op_or16(&p->regs, rm_read16(p), reg_read16(&p->regs, p->mode.reg)));
+   rm_write16(p, lazy_or16(p, rm_read16(p), reg_read16(&p->regs, p->mode.reg)));
 }
 
 static void or_A(CONSTSP(cpu) p) {
-   reg_write8(&p->regs, p->mode.reg, op_or8(&p->regs, reg_read8(&p->regs, p->mode.reg), rm_read8(p)));
+   reg_write8(&p->regs, p->mode.reg, lazy_or8(p, reg_read8(&p->regs, p->mode.reg), rm_read8(p)));
 }
 
 static void or_B(CONSTSP(cpu) p) {
-   reg_write16(&p->regs, p->mode.reg, op_or16(&p->regs, reg_read16(&p->regs, p->mode.reg), rm_read16(p)));
+   reg_write16(&p->regs, p->mode.reg, lazy_or16(p, reg_read16(&p->regs, p->mode.reg), rm_read16(p)));
 }
 
 static void or_C(CONSTSP(cpu) p) {
-   p->regs.al = op_or8(&p->regs, p->regs.al, read_opcode8(p));
+   p->regs.al = lazy_or8(p, p->regs.al, read_opcode8(p));
 }
 
 static void or_D(CONSTSP(cpu) p) {
-   p->regs.ax = op_or16(&p->regs, p->regs.ax, read_opcode16(p));
+   p->regs.ax = lazy_or16(p, p->regs.ax, read_opcode16(p));
 }
 
 static void invalid_op(CONSTSP(cpu) p) {
    VALIDATOR_DISCARD(p);
-   PRINT("invalid opcode: 0x%X", p->inst->opcode);
+   PRINT("invalid opcode: 0x%X", p->opcode);
    p->regs.debug = true;
 }
 
@@ -131,27 +132,27 @@ static void invalid_prefix(CONSTSP(cpu) p) {
 #define CARRY (((p->inst->opcode < 0x1F) && (p->regs.flags & VXT_CARRY)) ? 1 : 0)
 
 static void sub_18_28(CONSTSP(cpu) p) {
-   rm_write8(p, op_sub_sbb8(&p->regs, rm_read8(p), reg_read8(&p->regs, p->mode.reg), CARRY));
+   rm_write8(p, lazy_sub_sbb8(p, rm_read8(p), reg_read8(&p->regs, p->mode.reg), CARRY));
 }
 
 static void sub_19_29(CONSTSP(cpu) p) {
-   rm_write16(p, op_sub_sbb16(&p->regs, rm_read16(p), reg_read16(&p->regs, p->mode.reg), CARRY));
+   rm_write16(p, lazy_sub_sbb16(p, rm_read16(p), reg_read16(&p->regs, p->mode.reg), CARRY));
 }
 
 static void sub_1A_2A(CONSTSP(cpu) p) {
-   reg_write8(&p->regs, p->mode.reg, op_sub_sbb8(&p->regs, reg_read8(&p->regs, p->mode.reg), rm_read8(p), CARRY));
+   reg_write8(&p->regs, p->mode.reg, lazy_sub_sbb8(p, reg_read8(&p->regs, p->mode.reg), rm_read8(p), CARRY));
 }
 
 static void sub_1B_2B(CONSTSP(cpu) p) {
-   reg_write16(&p->regs, p->mode.reg, op_sub_sbb16(&p->regs, reg_read16(&p->regs, p->mode.reg), rm_read16(p), CARRY));
+   reg_write16(&p->regs, p->mode.reg, lazy_sub_sbb16(p, reg_read16(&p->regs, p->mode.reg), rm_read16(p), CARRY));
 }
 
 static void sub_1C_2C(CONSTSP(cpu) p) {
-   p->regs.al = op_sub_sbb8(&p->regs, p->regs.al, read_opcode8(p), CARRY);
+   p->regs.al = lazy_sub_sbb8(p, p->regs.al, read_opcode8(p), CARRY);
 }
 
 static void sub_1D_2D(CONSTSP(cpu) p) {
-   p->regs.ax = op_sub_sbb16(&p->regs, p->regs.ax, read_opcode16(p), CARRY);
+   p->regs.ax = lazy_sub_sbb16(p, p->regs.ax, read_opcode16(p), CARRY);
 }
 
 #undef CARRY
@@ -180,27 +181,27 @@ static void das_2F(CONSTSP(cpu) p) {
 }
 
 static void and_20(CONSTSP(cpu) p) {
-   rm_write8(p, op_and8(&p->regs, rm_read8(p), reg_read8(&p->regs, p->mode.reg)));
+   rm_write8(p, lazy_and8(p, rm_read8(p), reg_read8(&p->regs, p->mode.reg)));
 }
 
 static void and_21(CONSTSP(cpu) p) {
-   rm_write16(p, op_and16(&p->regs, rm_read16(p), reg_read16(&p->regs, p->mode.reg)));
+   rm_write16(p, lazy_and16(p, rm_read16(p), reg_read16(&p->regs, p->mode.reg)));
 }
 
 static void and_22(CONSTSP(cpu) p) {
-   reg_write8(&p->regs, p->mode.reg, op_and8(&p->regs, reg_read8(&p->regs, p->mode.reg), rm_read8(p)));
+   reg_write8(&p->regs, p->mode.reg, lazy_and8(p, reg_read8(&p->regs, p->mode.reg), rm_read8(p)));
 }
 
 static void and_23(CONSTSP(cpu) p) {
-   reg_write16(&p->regs, p->mode.reg, op_and16(&p->regs, reg_read16(&p->regs, p->mode.reg), rm_read16(p)));
+   reg_write16(&p->regs, p->mode.reg, lazy_and16(p, reg_read16(&p->regs, p->mode.reg), rm_read16(p)));
 }
 
 static void and_24(CONSTSP(cpu) p) {
-   p->regs.al = op_and8(&p->regs, p->regs.al, read_opcode8(p));
+   p->regs.al = lazy_and8(p, p->regs.al, read_opcode8(p));
 }
 
 static void and_25(CONSTSP(cpu) p) {
-   p->regs.ax = op_and16(&p->regs, p->regs.ax, read_opcode16(p));
+   p->regs.ax = lazy_and16(p, p->regs.ax, read_opcode16(p));
 }
 
 static void daa_27(CONSTSP(cpu) p) {
@@ -226,27 +227,27 @@ static void daa_27(CONSTSP(cpu) p) {
 }
 
 static void xor_30(CONSTSP(cpu) p) {
-   rm_write8(p, op_xor8(&p->regs, rm_read8(p), reg_read8(&p->regs, p->mode.reg)));
+   rm_write8(p, lazy_xor8(p, rm_read8(p), reg_read8(&p->regs, p->mode.reg)));
 }
 
 static void xor_31(CONSTSP(cpu) p) {
-   rm_write16(p, op_xor16(&p->regs, rm_read16(p), reg_read16(&p->regs, p->mode.reg)));
+   rm_write16(p, lazy_xor16(p, rm_read16(p), reg_read16(&p->regs, p->mode.reg)));
 }
 
 static void xor_32(CONSTSP(cpu) p) {
-   reg_write8(&p->regs, p->mode.reg, op_xor8(&p->regs, reg_read8(&p->regs, p->mode.reg), rm_read8(p)));
+   reg_write8(&p->regs, p->mode.reg, lazy_xor8(p, reg_read8(&p->regs, p->mode.reg), rm_read8(p)));
 }
 
 static void xor_33(CONSTSP(cpu) p) {
-   reg_write16(&p->regs, p->mode.reg, op_xor16(&p->regs, reg_read16(&p->regs, p->mode.reg), rm_read16(p)));
+   reg_write16(&p->regs, p->mode.reg, lazy_xor16(p, reg_read16(&p->regs, p->mode.reg), rm_read16(p)));
 }
 
 static void xor_34(CONSTSP(cpu) p) {
-   p->regs.al = op_xor8(&p->regs, p->regs.al, read_opcode8(p));
+   p->regs.al = lazy_xor8(p, p->regs.al, read_opcode8(p));
 }
 
 static void xor_35(CONSTSP(cpu) p) {
-   p->regs.ax = op_xor16(&p->regs, p->regs.ax, read_opcode16(p));
+   p->regs.ax = lazy_xor16(p, p->regs.ax, read_opcode16(p));
 }
 
 #define ASCII(name, op)                                                          \
@@ -266,27 +267,27 @@ ASCII(aas_3F, -)
 #undef ASCII
 
 static void cmp_38(CONSTSP(cpu) p) {
-   flag_sub_sbb8(&p->regs, rm_read8(p), reg_read8(&p->regs, p->mode.reg), 0);
+   lazy_flag_sub_sbb8(p, rm_read8(p), reg_read8(&p->regs, p->mode.reg), 0);
 }
 
 static void cmp_39(CONSTSP(cpu) p) {
-   flag_sub_sbb16(&p->regs, rm_read16(p), reg_read16(&p->regs, p->mode.reg), 0);
+   lazy_flag_sub_sbb16(p, rm_read16(p), reg_read16(&p->regs, p->mode.reg), 0);
 }
 
 static void cmp_3A(CONSTSP(cpu) p) {
-   flag_sub_sbb8(&p->regs, reg_read8(&p->regs, p->mode.reg), rm_read8(p), 0);
+   lazy_flag_sub_sbb8(p, reg_read8(&p->regs, p->mode.reg), rm_read8(p), 0);
 }
 
 static void cmp_3B(CONSTSP(cpu) p) {
-   flag_sub_sbb16(&p->regs, reg_read16(&p->regs, p->mode.reg), rm_read16(p), 0);
+   lazy_flag_sub_sbb16(p, reg_read16(&p->regs, p->mode.reg), rm_read16(p), 0);
 }
 
 static void cmp_3C(CONSTSP(cpu) p) {
-   flag_sub_sbb8(&p->regs, p->regs.al, read_opcode8(p), 0);
+   lazy_flag_sub_sbb8(p, p->regs.al, read_opcode8(p), 0);
 }
 
 static void cmp_3D(CONSTSP(cpu) p) {
-   flag_sub_sbb16(&p->regs, p->regs.ax, read_opcode16(p), 0);
+   lazy_flag_sub_sbb16(p, p->regs.ax, read_opcode16(p), 0);
 }
 
 static void inc_reg(CONSTSP(cpu) p) {
@@ -399,28 +400,30 @@ static void grp1_80_82(CONSTSP(cpu) p) {
 
    switch (p->mode.reg) {
       case 0:
-         res = op_add_adc8(&p->regs, a, b, 0);
+         res = lazy_add_adc8(p, a, b, 0);
          break;
       case 1:
-         res = op_or8(&p->regs, a, b);
+         res = lazy_or8(p, a, b);
          break;
       case 2:
-         res = op_add_adc8(&p->regs, a, b, (p->regs.flags & VXT_CARRY) ? 1 : 0);
+         flags_materialize(p);
+         res = lazy_add_adc8(p, a, b, (p->regs.flags & VXT_CARRY) ? 1 : 0);
          break;
       case 3:
-         res = op_sub_sbb8(&p->regs, a, b, (p->regs.flags & VXT_CARRY) ? 1 : 0);
+         flags_materialize(p);
+         res = lazy_sub_sbb8(p, a, b, (p->regs.flags & VXT_CARRY) ? 1 : 0);
          break;
       case 4:
-         res = op_and8(&p->regs, a, b);
+         res = lazy_and8(p, a, b);
          break;
       case 5:
-         res = op_sub_sbb8(&p->regs, a, b, 0);
+         res = lazy_sub_sbb8(p, a, b, 0);
          break;
       case 6:
-         res = op_xor8(&p->regs, a, b);
+         res = lazy_xor8(p, a, b);
          break;
       case 7:
-         flag_sub_sbb8(&p->regs, a, b, 0);
+         lazy_flag_sub_sbb8(p, a, b, 0);
          break;
       default:
          UNREACHABLE();
@@ -437,28 +440,30 @@ static void grp1_81_83(CONSTSP(cpu) p) {
 
    switch (p->mode.reg) {
       case 0:
-         res = op_add_adc16(&p->regs, a, b, 0);
+         res = lazy_add_adc16(p, a, b, 0);
          break;
       case 1:
-         res = op_or16(&p->regs, a, b);
+         res = lazy_or16(p, a, b);
          break;
       case 2:
-         res = op_add_adc16(&p->regs, a, b, (p->regs.flags & VXT_CARRY) ? 1 : 0);
+         flags_materialize(p);
+         res = lazy_add_adc16(p, a, b, (p->regs.flags & VXT_CARRY) ? 1 : 0);
          break;
       case 3:
-         res = op_sub_sbb16(&p->regs, a, b, (p->regs.flags & VXT_CARRY) ? 1 : 0);
+         flags_materialize(p);
+         res = lazy_sub_sbb16(p, a, b, (p->regs.flags & VXT_CARRY) ? 1 : 0);
          break;
       case 4:
-         res = op_and16(&p->regs, a, b);
+         res = lazy_and16(p, a, b);
          break;
       case 5:
-         res = op_sub_sbb16(&p->regs, a, b, 0);
+         res = lazy_sub_sbb16(p, a, b, 0);
          break;
       case 6:
-         res = op_xor16(&p->regs, a, b);
+         res = lazy_xor16(p, a, b);
          break;
       case 7:
-         flag_sub_sbb16(&p->regs, a, b, 0);
+         lazy_flag_sub_sbb16(p, a, b, 0);
          break;
       default:
          UNREACHABLE();
@@ -469,11 +474,11 @@ static void grp1_81_83(CONSTSP(cpu) p) {
 }
 
 static void test_84(CONSTSP(cpu) p) {
-   flag_logic8(&p->regs, reg_read8(&p->regs, p->mode.reg) & rm_read8(p));
+   lazy_flag_logic8(p, reg_read8(&p->regs, p->mode.reg) & rm_read8(p));
 }
 
 static void test_85(CONSTSP(cpu) p) {
-   flag_logic16(&p->regs, reg_read16(&p->regs, p->mode.reg) & rm_read16(p));
+   lazy_flag_logic16(p, reg_read16(&p->regs, p->mode.reg) & rm_read16(p));
 }
 
 static void xchg_86(CONSTSP(cpu) p) {
@@ -601,11 +606,11 @@ static void mov_A3(CONSTSP(cpu) p) {
 }
 
 static void test_A8(CONSTSP(cpu) p) {
-   flag_logic8(&p->regs, p->regs.al & read_opcode8(p));
+   lazy_flag_logic8(p, p->regs.al & read_opcode8(p));
 }
 
 static void test_A9(CONSTSP(cpu) p) {
-   flag_logic16(&p->regs, p->regs.ax & read_opcode16(p));
+   lazy_flag_logic16(p, p->regs.ax & read_opcode16(p));
 }
 
 static void mov_reg8(CONSTSP(cpu) p) {
@@ -726,18 +731,22 @@ static void iret_CF(CONSTSP(cpu) p) {
 
 static void grp2_D0(CONSTSP(cpu) p) {
    rm_write8(p, bitshift_8(p, rm_read8(p), 1));
+   p->cycles += rm_cycles(p, 1, 14); // 2, memory 15
 }
 
 static void grp2_D1(CONSTSP(cpu) p) {
    rm_write16(p, bitshift_16(p, rm_read16(p), 1));
+   p->cycles += rm_cycles(p, 1, 22); // 2, memory 23
 }
 
 static void grp2_D2(CONSTSP(cpu) p) {
    rm_write8(p, bitshift_8(p, rm_read8(p), p->regs.cl));
+   p->cycles += rm_cycles(p, 7, 19) + 4 * (int)p->regs.cl; // 8, memory 20
 }
 
 static void grp2_D3(CONSTSP(cpu) p) {
    rm_write16(p, bitshift_16(p, rm_read16(p), p->regs.cl));
+   p->cycles += rm_cycles(p, 7, 27) + 4 * (int)p->regs.cl; // 8, memory 28
 }
 
 static void aam_D4(CONSTSP(cpu) p) {
@@ -766,13 +775,6 @@ static void salc_D6(CONSTSP(cpu) p) {
    p->regs.al = (p->regs.flags & VXT_CARRY) ? 0xFF : 0x0;
 }
 
-static void fpu_dummy(CONSTSP(cpu) p) {
-   VALIDATOR_DISCARD(p);
-   
-   // 286 only
-   call_int(p, 7);
-}
-
 static void in_E4(CONSTSP(cpu) p) {
    p->regs.al = system_in(p->s, read_opcode8(p));
 }
@@ -852,9 +854,11 @@ static void grp3_F6(CONSTSP(cpu) p) {
       case 0: // TEST Eb Ib
       case 1:
          flag_logic8(&p->regs, v & read_opcode8(p));
+         p->cycles += rm_cycles(p, 4, 10); // 5, memory 11
          break;
       case 2: // NOT
          rm_write8(p, ~v);
+         p->cycles += rm_cycles(p, 2, 15); // 3, memory 16
          break;
       case 3: // NEG
       {
@@ -862,6 +866,7 @@ static void grp3_F6(CONSTSP(cpu) p) {
          flag_sub_sbb8(&p->regs, 0, v, 0);
          SET_FLAG_IF(p->regs.flags, VXT_CARRY, res);
          rm_write8(p, res);
+         p->cycles += rm_cycles(p, 2, 15);
          break;
       }
       case 4: // MUL
@@ -870,6 +875,7 @@ static void grp3_F6(CONSTSP(cpu) p) {
          flag_szp8(&p->regs, p->regs.al);
          SET_FLAG_IF(p->regs.flags, VXT_CARRY|VXT_OVERFLOW, p->regs.ah);
          p->regs.flags &= ~VXT_ZERO;
+         p->cycles += 69 + bit_count(v) + rm_cycles(p, 0, 6); // 70-77, memory 76-83
          break;
       }
       case 5: // IMUL
@@ -883,6 +889,7 @@ static void grp3_F6(CONSTSP(cpu) p) {
          flag_szp8(&p->regs, res8);
          p->regs.flags &= ~VXT_ZERO;
          SET_FLAG_IF(p->regs.flags, VXT_CARRY|VXT_OVERFLOW, res != (vxt_int8)res);
+         p->cycles += 79 + bit_count(abs16(b)) + ((res < 0) ? 10 : 0) + rm_cycles(p, 0, 6); // 80-98, memory 86-104
          break;
       }
       case 6: // DIV
@@ -904,6 +911,7 @@ static void grp3_F6(CONSTSP(cpu) p) {
 
          p->regs.ah = (vxt_byte)r;
          p->regs.al = (vxt_byte)q8;
+         p->cycles += 79 + bit_count(~q8 & 0xFF) + rm_cycles(p, 0, 6); // 80-90, memory 86-96
          break;
       }
       case 7: // IDIV
@@ -936,6 +944,7 @@ static void grp3_F6(CONSTSP(cpu) p) {
 
          p->regs.ah = (vxt_byte)r;
          p->regs.al = (vxt_byte)q8;
+         p->cycles += 100 + bit_count(~abs16(q8) & 0x7F) + ((q8 < 0) ? 4 : 0) + rm_cycles(p, 0, 6); // 101-112, memory 107-118
          break;
       }
    }
@@ -947,9 +956,11 @@ static void grp3_F7(CONSTSP(cpu) p) {
       case 0: // TEST Ev Iv
       case 1:
          flag_logic16(&p->regs, v & read_opcode16(p));
+         p->cycles += rm_cycles(p, 4, 14); // 5, memory 15
          break;
       case 2: // NOT
          rm_write16(p, ~v);
+         p->cycles += rm_cycles(p, 2, 23); // 3, memory 24
          break;
       case 3: // NEG
       {
@@ -957,6 +968,7 @@ static void grp3_F7(CONSTSP(cpu) p) {
          flag_sub_sbb16(&p->regs, 0, v, 0);
          SET_FLAG_IF(p->regs.flags, VXT_CARRY, res);
          rm_write16(p, res);
+         p->cycles += rm_cycles(p, 2, 23);
          break;
       }
       case 4: // MUL
@@ -967,6 +979,7 @@ static void grp3_F7(CONSTSP(cpu) p) {
          flag_szp16(&p->regs, p->regs.ax);
          SET_FLAG_IF(p->regs.flags, VXT_CARRY|VXT_OVERFLOW, p->regs.dx);
          p->regs.flags &= ~VXT_ZERO;
+         p->cycles += 117 + bit_count(v) + rm_cycles(p, 0, 10); // 118-133, memory 128-143
          break;
       }
       case 5: // IMUL
@@ -981,6 +994,7 @@ static void grp3_F7(CONSTSP(cpu) p) {
          flag_szp16(&p->regs, p->regs.ax);
          p->regs.flags &= ~VXT_ZERO;
          SET_FLAG_IF(p->regs.flags, VXT_CARRY|VXT_OVERFLOW, res != (vxt_int16)res);
+         p->cycles += 127 + bit_count(abs16(b)) + ((res < 0) ? 10 : 0) + rm_cycles(p, 0, 10); // 128-154, memory 138-164
          break;
       }
       case 6: // DIV
@@ -1002,6 +1016,7 @@ static void grp3_F7(CONSTSP(cpu) p) {
 
          p->regs.dx = r;
          p->regs.ax = q16;
+         p->cycles += 143 + bit_count(~q16) + rm_cycles(p, 0, 10); // 144-162, memory 154-172
          break;
       }
       case 7: // IDIV
@@ -1034,6 +1049,7 @@ static void grp3_F7(CONSTSP(cpu) p) {
 
          p->regs.ax = (vxt_word)q16;
          p->regs.dx = (vxt_word)r;
+         p->cycles += 164 + bit_count(~abs16(q16) & 0x7FFF) + ((q16 < 0) ? 4 : 0) + rm_cycles(p, 0, 10); // 165-184, memory 175-194
          break;
       }
    }
@@ -22,14 +22,19 @@
 #include "common.h"
 #include "exec.h"
 
+// 8086 only. Later CPUs use this opcode for extended instructions.
+static void pop_cs_0F(CONSTSP(cpu) p) {
+    p->regs.cs = pop(p);
+    p->inst_queue_dirty = true;
+}
+
 static void extended_F(CONSTSP(cpu) p) {
     VALIDATOR_DISCARD(p);
 
     #ifdef TESTING
 
         // 8086 - pop cs
-        p->regs.cs = pop(p);
-        p->inst_queue_dirty = true;
+        pop_cs_0F(p);
 
     #else
 
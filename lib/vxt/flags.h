@@ -144,6 +144,70 @@ static vxt_word op_sub_sbb16(CONSTSP(vxt_registers) r, vxt_word a, vxt_word b, v
    return d;
 }
 
+// Lazy variants only record the operands. The flags are written to regs.flags
+// by flags_materialize, before any instruction that reads or partially updates them.
+enum lazy_flags_op {
+   LAZY_NONE,
+   LAZY_ADD8,
+   LAZY_ADD16,
+   LAZY_SUB8,
+   LAZY_SUB16,
+   LAZY_LOGIC8,
+   LAZY_LOGIC16
+};
+
+static void flags_materialize(CONSTSP(cpu) p) {
+   CONSTSP(lazy_flags) l = &p->lazy;
+   switch (l->op) {
+      case LAZY_NONE: return;
+      case LAZY_ADD8: flag_add_adc8(&p->regs, (vxt_byte)l->a, (vxt_byte)l->b, (vxt_byte)l->c); break;
+      case LAZY_ADD16: flag_add_adc16(&p->regs, l->a, l->b, l->c); break;
+      case LAZY_SUB8: flag_sub_sbb8(&p->regs, (vxt_byte)l->a, (vxt_byte)l->b, (vxt_byte)l->c); break;
+      case LAZY_SUB16: flag_sub_sbb16(&p->regs, l->a, l->b, l->c); break;
+      case LAZY_LOGIC8: flag_logic8(&p->regs, (vxt_byte)l->a); break;
+      case LAZY_LOGIC16: flag_logic16(&p->regs, l->a); break;
+   }
+   l->op = LAZY_NONE;
+}
+
+static void lazy_flags_set(CONSTSP(cpu) p, int op, vxt_word a, vxt_word b, vxt_word c) {
+   CONSTSP(lazy_flags) l = &p->lazy;
+   // Logic operations leave AF untouched so it needs to be resolved first.
+   if (((op == LAZY_LOGIC8) || (op == LAZY_LOGIC16)) && (l->op != LAZY_NONE) && (l->op != LAZY_LOGIC8) && (l->op != LAZY_LOGIC16))
+      flags_materialize(p);
+   l->op = op;
+   l->a = a;
+   l->b = b;
+   l->c = c;
+}
+
+static void lazy_flag_add_adc8(CONSTSP(cpu) p, vxt_byte a, vxt_byte b, vxt_byte c) { lazy_flags_set(p, LAZY_ADD8, a, b, c); }
+static void lazy_flag_add_adc16(CONSTSP(cpu) p, vxt_word a, vxt_word b, vxt_word c) { lazy_flags_set(p, LAZY_ADD16, a, b, c); }
+static void lazy_flag_sub_sbb8(CONSTSP(cpu) p, vxt_byte a, vxt_byte b, vxt_byte c) { lazy_flags_set(p, LAZY_SUB8, a, b, c); }
+static void lazy_flag_sub_sbb16(CONSTSP(cpu) p, vxt_word a, vxt_word b, vxt_word c) { lazy_flags_set(p, LAZY_SUB16, a, b, c); }
+static void lazy_flag_logic8(CONSTSP(cpu) p, vxt_byte v) { lazy_flags_set(p, LAZY_LOGIC8, v, 0, 0); }
+static void lazy_flag_logic16(CONSTSP(cpu) p, vxt_word v) { lazy_flags_set(p, LAZY_LOGIC16, v, 0, 0); }
+
+static vxt_byte lazy_add_adc8(CONSTSP(cpu) p, vxt_byte a, vxt_byte b, vxt_byte c) {
+   lazy_flag_add_adc8(p, a, b, c);
+   return a + b + c;
+}
+
+static vxt_word lazy_add_adc16(CONSTSP(cpu) p, vxt_word a, vxt_word b, vxt_word c) {
+   lazy_flag_add_adc16(p, a, b, c);
+   return a + b + c;
+}
+
+static vxt_byte lazy_sub_sbb8(CONSTSP(cpu) p, vxt_byte a, vxt_byte b, vxt_byte c) {
+   lazy_flag_sub_sbb8(p, a, b, c);
+   return a - (b + c);
+}
+
+static vxt_word lazy_sub_sbb16(CONSTSP(cpu) p, vxt_word a, vxt_word b, vxt_word c) {
+   lazy_flag_sub_sbb16(p, a, b, c);
+   return a - (b + c);
+}
+
 #define NARROW(name, op, f) f(name, op, byte, 8)
 #define WIDE(name, op, f) f(name, op, word, 16)
 
@@ -152,9 +216,9 @@ static vxt_word op_sub_sbb16(CONSTSP(vxt_registers) r, vxt_word a, vxt_word b, v
 #define XOR(f) f(xor, ^)
 
 #define LOGIC_OP_FUNC(name, op, width, bits)                                                                 \
-static vxt_ ## width op_ ## name ## bits (CONSTSP(vxt_registers) r, vxt_ ## width a, vxt_ ## width b) {      \
+static vxt_ ## width lazy_ ## name ## bits (CONSTSP(cpu) p, vxt_ ## width a, vxt_ ## width b) {              \
    vxt_ ## width d = a op b;                                                                                 \
-	flag_logic ## bits (r, d);                                                                                \
+	lazy_flag_logic ## bits (p, d);                                                                           \
    return d;                                                                                                 \
 }                                                                                                            \
 
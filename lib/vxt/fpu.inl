@@ -0,0 +1,775 @@
+// Copyright (c) 2019-2024 Andreas T Jonsson <mail@andreasjonsson.se>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+//
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any source
+//    distribution.
+
+#include "common.h"
+#include "exec.h"
+
+// 8087 numeric coprocessor. Arithmetic is done on the host long double. Conversions to
+// integer and BCD, and FRNDINT, round explicitly according to the rounding control field
+// so they don't depend on the host rounding mode.
+
+#define FPU_IE 0x1
+#define FPU_DE 0x2
+#define FPU_ZE 0x4
+#define FPU_OE 0x8
+#define FPU_UE 0x10
+#define FPU_PE 0x20
+#define FPU_EXCEPTIONS 0x3F
+#define FPU_ES 0x80
+#define FPU_C0 0x100
+#define FPU_C1 0x200
+#define FPU_C2 0x400
+#define FPU_C3 0x4000
+#define FPU_CC (FPU_C0 | FPU_C1 | FPU_C2 | FPU_C3)
+
+#define FPU_IEM 0x80
+
+#define FPU_TAG_VALID 0
+#define FPU_TAG_ZERO 1
+#define FPU_TAG_SPECIAL 2
+#define FPU_TAG_EMPTY 3
+
+#define FPU_TOP(f) (((f)->status >> 11) & 7)
+#define FPU_PHYS(f, i) ((FPU_TOP(f) + (i)) & 7)
+
+#ifdef VXT_NO_FPU
+
+static void fpu_esc(CONSTSP(cpu) p) {
+   VALIDATOR_DISCARD(p);
+
+   // 286 only
+   call_int(p, 7);
+}
+
+#else
+
+#include <float.h>
+#include <math.h>
+
+// Smallest normal extended value. This is only the 8087 limit on hosts with 80-bit long double.
+#define FPU_MIN_NORMAL LDBL_MIN
+
+static void fpu_reset(CONSTSP(cpu) p) {
+   CONSTSP(fpu) f = &p->fpu;
+   f->control = 0x3FF;
+   f->status = 0;
+   f->tag = 0xFFFF;
+   f->opcode = 0;
+   f->ip = f->dp = 0;
+}
+
+static void fpu_exception(CONSTSP(cpu) p, vxt_word e) {
+   p->fpu.status |= e;
+}
+
+static int fpu_tag(CONSTSP(fpu) f, int i) {
+   return (f->tag >> (FPU_PHYS(f, i) * 2)) & 3;
+}
+
+static void fpu_set_tag(CONSTSP(fpu) f, int i, int t) {
+   const int shift = FPU_PHYS(f, i) * 2;
+   f->tag = (f->tag & ~(3 << shift)) | (t << shift);
+}
+
+static void fpu_set_top(CONSTSP(fpu) f, int top) {
+   f->status = (f->status & ~0x3800) | ((top & 7) << 11);
+}
+
+static int fpu_classify(long double v) {
+   if (v == 0.0L)
+      return FPU_TAG_ZERO;
+   else if (!isfinite(v) || (fabsl(v) < FPU_MIN_NORMAL))
+      return FPU_TAG_SPECIAL;
+   return FPU_TAG_VALID;
+}
+
+static long double fpu_indefinite(void) {
+   return -(long double)NAN;
+}
+
+static long double fpu_get(CONSTSP(cpu) p, int i) {
+   CONSTSP(fpu) f = &p->fpu;
+   if (fpu_tag(f, i) == FPU_TAG_EMPTY) {
+      // Stack underflow
+      fpu_exception(p, FPU_IE);
+      return fpu_indefinite();
+   }
+   return f->regs[FPU_PHYS(f, i)];
+}
+
+static void fpu_set(CONSTSP(cpu) p, int i, long double v) {
+   CONSTSP(fpu) f = &p->fpu;
+   f->regs[FPU_PHYS(f, i)] = v;
+   fpu_set_tag(f, i, fpu_classify(v));
+}
+
+static void fpu_push(CONSTSP(cpu) p, long double v) {
+   CONSTSP(fpu) f = &p->fpu;
+   fpu_set_top(f, FPU_TOP(f) - 1);
+   if (fpu_tag(f, 0) != FPU_TAG_EMPTY) {
+      // Stack overflow
+      fpu_exception(p, FPU_IE);
+      v = fpu_indefinite();
+   }
+   fpu_set(p, 0, v);
+}
+
+static void fpu_pop(CONSTSP(cpu) p) {
+   CONSTSP(fpu) f = &p->fpu;
+   fpu_set_tag(f, 0, FPU_TAG_EMPTY);
+   fpu_set_top(f, FPU_TOP(f) + 1);
+}
+
+// Flags exceptions caused by producing 'r' from the operands 'a' and 'b'.
+static long double fpu_result(CONSTSP(cpu) p, long double r, long double a, long double b) {
+   if (isnan(r)) {
+      if (!isnan(a) && !isnan(b))
+         fpu_exception(p, FPU_IE);
+   } else if (isinf(r)) {
+      if (isfinite(a) && isfinite(b))
+         fpu_exception(p, FPU_OE | FPU_PE);
+   } else if ((r != 0.0L) && (fabsl(r) < FPU_MIN_NORMAL)) {
+      fpu_exception(p, FPU_UE);
+   }
+   return r;
+}
+
+static long double fpu_round(CONSTSP(cpu) p, long double v) {
+   long double r;
+   switch ((p->fpu.control >> 10) & 3) {
+      case 0: // Nearest or even
+         r = floorl(v);
+         if (((v - r) > 0.5L) || (((v - r) == 0.5L) && (fmodl(r, 2.0L) != 0.0L)))
+            r += 1.0L;
+         break;
+      case 1: r = floorl(v); break;
+      case 2: r = ceill(v); break;
+      default: r = truncl(v); break;
+   }
+
+   if (r != v)
+      fpu_exception(p, FPU_PE);
+   return r;
+}
+
+static void fpu_compare(CONSTSP(cpu) p, long double a, long double b) {
+   CONSTSP(fpu) f = &p->fpu;
+   f->status &= ~FPU_CC;
+   if (isnan(a) || isnan(b)) {
+      fpu_exception(p, FPU_IE);
+      f->status |= FPU_C0 | FPU_C2 | FPU_C3;
+   } else if (a < b) {
+      f->status |= FPU_C0;
+   } else if (a == b) {
+      f->status |= FPU_C3;
+   }
+}
+
+static void fpu_examine(CONSTSP(cpu) p) {
+   CONSTSP(fpu) f = &p->fpu;
+   const long double v = f->regs[FPU_PHYS(f, 0)];
+
+   f->status &= ~FPU_CC;
+   if (signbit(v))
+      f->status |= FPU_C1;
+
+   if (fpu_tag(f, 0) == FPU_TAG_EMPTY)
+      f->status |= FPU_C3 | FPU_C0;
+   else if (isnan(v))
+      f->status |= FPU_C0;
+   else if (isinf(v))
+      f->status |= FPU_C2 | FPU_C0;
+   else if (v == 0.0L)
+      f->status |= FPU_C3;
+   else if (fabsl(v) < FPU_MIN_NORMAL)
+      f->status |= FPU_C3 | FPU_C2;
+   else
+      f->status |= FPU_C2;
+}
+
+// Operation is the reg field of the D8 encoding: ADD, MUL, COM, COMP, SUB, SUBR, DIV, DIVR.
+static void fpu_arith(CONSTSP(cpu) p, int op, int dst, long double src) {
+   const long double a = fpu_get(p, dst);
+   bool zero_divide = false;
+   long double r;
+
+   switch (op) {
+      case 0: r = a + src; break;
+      case 1: r = a * src; break;
+      case 2: fpu_compare(p, a, src); return;
+      case 3: fpu_compare(p, a, src); fpu_pop(p); return;
+      case 4: r = a - src; break;
+      case 5: r = src - a; break;
+      case 6:
+         zero_divide = (src == 0.0L) && (a != 0.0L) && isfinite(a);
+         r = a / src;
+         break;
+      case 7:
+         zero_divide = (a == 0.0L) && (src != 0.0L) && isfinite(src);
+         r = src / a;
+         break;
+      default:
+         UNREACHABLE();
+   }
+
+   if (zero_divide)
+      fpu_exception(p, FPU_ZE);
+   else
+      r = fpu_result(p, r, a, src);
+   fpu_set(p, dst, r);
+}
+
+static void fpu_read(CONSTSP(cpu) p, vxt_word offset, vxt_byte *data, int n) {
+   for (int i = 0; i < n; i++)
+      data[i] = (vxt_byte)cpu_segment_read_byte(p, p->seg, (vxt_word)(offset + i));
+}
+
+static void fpu_write(CONSTSP(cpu) p, vxt_word offset, const vxt_byte *data, int n) {
+   for (int i = 0; i < n; i++)
+      cpu_segment_write_byte(p, p->seg, (vxt_word)(offset + i), data[i]);
+}
+
+static uint64_t fpu_read_bits(const vxt_byte *data, int n) {
+   uint64_t v = 0;
+   for (int i = n - 1; i >= 0; i--)
+      v = (v << 8) | data[i];
+   return v;
+}
+
+static void fpu_write_bits(vxt_byte *data, uint64_t v, int n) {
+   for (int i = 0; i < n; i++, v >>= 8)
+      data[i] = (vxt_byte)v;
+}
+
+static long double fpu_from_real80(const vxt_byte *data) {
+   const uint64_t mant = fpu_read_bits(data, 8);
+   const int exp = WORD(data[9], data[8]) & 0x7FFF;
+   const bool sign = (data[9] & 0x80) != 0;
+
+   long double v;
+   if (exp == 0x7FFF)
+      v = (mant << 1) ? (long double)NAN : (long double)INFINITY;
+   else
+      v = ldexpl((long double)mant, (exp ? exp : 1) - 16383 - 63);
+   return sign ? -v : v;
+}
+
+static void fpu_to_real80(long double v, vxt_byte *data) {
+   uint64_t mant = 0;
+   int exp = 0;
+
+   if (isnan(v)) {
+      exp = 0x7FFF;
+      mant = 0xC000000000000000ull;
+   } else if (isinf(v)) {
+      exp = 0x7FFF;
+      mant = 0x8000000000000000ull;
+   } else if (v != 0.0L) {
+      int e;
+      const long double m = frexpl(fabsl(v), &e);
+      exp = e + 16382;
+      if (exp <= 0) {
+         // Denormal
+         mant = (uint64_t)ldexpl(m, 63 + exp);
+         exp = 0;
+      } else {
+         mant = (uint64_t)ldexpl(m, 64);
+      }
+   }
+
+   fpu_write_bits(data, mant, 8);
+   data[8] = LBYTE(exp);
+   data[9] = HBYTE(exp) | (signbit(v) ? 0x80 : 0);
+}
+
+static long double fpu_from_bcd(const vxt_byte *data) {
+   long double v = 0.0L;
+   for (int i = 8; i >= 0; i--)
+      v = v * 100.0L + (long double)((data[i] >> 4) * 10 + (data[i] & 0xF));
+   return (data[9] & 0x80) ? -v : v;
+}
+
+static void fpu_to_bcd(CONSTSP(cpu) p, long double v, vxt_byte *data) {
+   const long double r = isnan(v) ? v : fpu_round(p, v);
+   if (!(fabsl(r) < 1e18L)) {
+      // BCD indefinite
+      fpu_exception(p, FPU_IE);
+      vxt_memclear(data, 10);
+      data[7] = 0xC0;
+      data[8] = data[9] = 0xFF;
+      return;
+   }
+
+   uint64_t n = (uint64_t)fabsl(r);
+   for (int i = 0; i < 9; i++, n /= 100)
+      data[i] = (vxt_byte)(((n / 10) % 10) << 4) | (vxt_byte)(n % 10);
+   data[9] = signbit(r) ? 0x80 : 0;
+}
+
+static int64_t fpu_to_int(CONSTSP(cpu) p, long double v, int bits) {
+   const long double limit = ldexpl(1.0L, bits - 1);
+   const long double r = isnan(v) ? v : fpu_round(p, v);
+   if (!((r >= -limit) && (r < limit))) {
+      // Integer indefinite
+      fpu_exception(p, FPU_IE);
+      return (int64_t)(~(uint64_t)0 << (bits - 1));
+   }
+   return (int64_t)r;
+}
+
+// Reads an operand of the D8, DA, DC and DE memory forms.
+static long double fpu_load_arith(CONSTSP(cpu) p, vxt_word offset) {
+   vxt_byte data[8];
+   switch (p->opcode) {
+      case 0xD8:
+      {
+         float v;
+         fpu_read(p, offset, data, 4);
+         memcpy(&v, data, 4);
+         return (long double)v;
+      }
+      case 0xDA:
+         fpu_read(p, offset, data, 4);
+         return (long double)(int32_t)fpu_read_bits(data, 4);
+      case 0xDC:
+      {
+         double v;
+         fpu_read(p, offset, data, 8);
+         memcpy(&v, data, 8);
+         return (long double)v;
+      }
+      case 0xDE:
+         fpu_read(p, offset, data, 2);
+         return (long double)(int16_t)fpu_read_bits(data, 2);
+      default:
+         UNREACHABLE(0);
+   }
+}
+
+static void fpu_store_real(CONSTSP(cpu) p, vxt_word offset, long double v, int size) {
+   vxt_byte data[8];
+   if (size == 4) {
+      const float r = (float)v;
+      fpu_result(p, (long double)r, v, 0.0L);
+      memcpy(data, &r, 4);
+   } else {
+      const double r = (double)v;
+      fpu_result(p, (long double)r, v, 0.0L);
+      memcpy(data, &r, 8);
+   }
+   fpu_write(p, offset, data, size);
+}
+
+static void fpu_store_int(CONSTSP(cpu) p, vxt_word offset, long double v, int size) {
+   vxt_byte data[8];
+   fpu_write_bits(data, (uint64_t)fpu_to_int(p, v, size * 8), size);
+   fpu_write(p, offset, data, size);
+}
+
+static void fpu_store_env(CONSTSP(cpu) p, vxt_word offset) {
+   CONSTSP(fpu) f = &p->fpu;
+   const vxt_word env[7] = {
+      f->control, f->status, f->tag,
+      (vxt_word)f->ip, (vxt_word)(((f->ip >> 4) & 0xF000) | (f->opcode & 0x7FF)),
+      (vxt_word)f->dp, (vxt_word)((f->dp >> 4) & 0xF000)
+   };
+   for (int i = 0; i < 7; i++)
+      cpu_segment_write_word(p, p->seg, offset + i * 2, env[i]);
+}
+
+static void fpu_load_env(CONSTSP(cpu) p, vxt_word offset) {
+   CONSTSP(fpu) f = &p->fpu;
+   vxt_word env[7];
+   for (int i = 0; i < 7; i++)
+      env[i] = cpu_segment_read_word(p, p->seg, offset + i * 2);
+
+   f->control = env[0];
+   f->status = env[1];
+   f->tag = env[2];
+   f->ip = ((vxt_pointer)(env[4] & 0xF000) << 4) | env[3];
+   f->opcode = env[4] & 0x7FF;
+   f->dp = ((vxt_pointer)(env[6] & 0xF000) << 4) | env[5];
+}
+
+static void fpu_save(CONSTSP(cpu) p, vxt_word offset) {
+   fpu_store_env(p, offset);
+   for (int i = 0; i < 8; i++) {
+      vxt_byte data[10];
+      fpu_to_real80(p->fpu.regs[FPU_PHYS(&p->fpu, i)], data);
+      fpu_write(p, offset + 14 + i * 10, data, 10);
+   }
+   fpu_reset(p);
+}
+
+static void fpu_restore(CONSTSP(cpu) p, vxt_word offset) {
+   fpu_load_env(p, offset);
+   for (int i = 0; i < 8; i++) {
+      vxt_byte data[10];
+      fpu_read(p, offset + 14 + i * 10, data, 10);
+      p->fpu.regs[FPU_PHYS(&p->fpu, i)] = fpu_from_real80(data);
+   }
+}
+
+static void fpu_memory(CONSTSP(cpu) p, vxt_word offset) {
+   CONSTSP(fpu) f = &p->fpu;
+   vxt_byte data[10];
+
+   switch (((p->opcode & 7) << 3) | p->mode.reg) {
+      case 0x08: // FLD m32real
+      {
+         float v;
+         fpu_read(p, offset, data, 4);
+         memcpy(&v, data, 4);
+         fpu_push(p, (long double)v);
+         return;
+      }
+      case 0x0A: // FST m32real
+      case 0x0B: // FSTP m32real
+         fpu_store_real(p, offset, fpu_get(p, 0), 4);
+         break;
+      case 0x0C: // FLDENV
+         fpu_load_env(p, offset);
+         return;
+      case 0x0D: // FLDCW
+         f->control = cpu_segment_read_word(p, p->seg, offset);
+         return;
+      case 0x0E: // FSTENV
+         fpu_store_env(p, offset);
+         return;
+      case 0x0F: // FSTCW
+         cpu_segment_write_word(p, p->seg, offset, f->control);
+         return;
+      case 0x18: // FILD m32int
+         fpu_read(p, offset, data, 4);
+         fpu_push(p, (long double)(int32_t)fpu_read_bits(data, 4));
+         return;
+      case 0x1A: // FIST m32int
+      case 0x1B: // FISTP m32int
+         fpu_store_int(p, offset, fpu_get(p, 0), 4);
+         break;
+      case 0x1D: // FLD m80real
+         fpu_read(p, offset, data, 10);
+         fpu_push(p, fpu_from_real80(data));
+         return;
+      case 0x1F: // FSTP m80real
+         fpu_to_real80(fpu_get(p, 0), data);
+         fpu_write(p, offset, data, 10);
+         fpu_pop(p);
+         return;
+      case 0x28: // FLD m64real
+      {
+         double v;
+         fpu_read(p, offset, data, 8);
+         memcpy(&v, data, 8);
+         fpu_push(p, (long double)v);
+         return;
+      }
+      case 0x2A: // FST m64real
+      case 0x2B: // FSTP m64real
+         fpu_store_real(p, offset, fpu_get(p, 0), 8);
+         break;
+      case 0x2C: // FRSTOR
+         fpu_restore(p, offset);
+         return;
+      case 0x2E: // FSAVE
+         fpu_save(p, offset);
+         return;
+      case 0x2F: // FSTSW m16
+         cpu_segment_write_word(p, p->seg, offset, f->status);
+         return;
+      case 0x38: // FILD m16int
+         fpu_read(p, offset, data, 2);
+         fpu_push(p, (long double)(int16_t)fpu_read_bits(data, 2));
+         return;
+      case 0x3A: // FIST m16int
+      case 0x3B: // FISTP m16int
+         fpu_store_int(p, offset, fpu_get(p, 0), 2);
+         break;
+      case 0x3C: // FBLD
+         fpu_read(p, offset, data, 10);
+         fpu_push(p, fpu_from_bcd(data));
+         return;
+      case 0x3D: // FILD m64int
+         fpu_read(p, offset, data, 8);
+         fpu_push(p, (long double)(int64_t)fpu_read_bits(data, 8));
+         return;
+      case 0x3E: // FBSTP
+         fpu_to_bcd(p, fpu_get(p, 0), data);
+         fpu_write(p, offset, data, 10);
+         fpu_pop(p);
+         return;
+      case 0x3F: // FISTP m64int
+         fpu_store_int(p, offset, fpu_get(p, 0), 8);
+         fpu_pop(p);
+         return;
+      default: // Arithmetic or undefined
+         if (!(p->opcode & 1))
+            fpu_arith(p, p->mode.reg, 0, fpu_load_arith(p, offset));
+         return;
+   }
+
+   // Store and pop forms all have bit 0 of the reg field set.
+   if (p->mode.reg & 1)
+      fpu_pop(p);
+}
+
+static void fpu_constant(CONSTSP(cpu) p, int n) {
+   static const long double constants[7] = {
+      1.0L,
+      3.32192809488736234787L, // log2(10)
+      1.44269504088896340736L, // log2(e)
+      3.14159265358979323846L, // pi
+      0.30102999566398119521L, // log10(2)
+      0.69314718055994530942L, // ln(2)
+      0.0L
+   };
+   if (n < 7)
+      fpu_push(p, constants[n]);
+}
+
+static void fpu_transcendental(CONSTSP(cpu) p, int n) {
+   const long double a = fpu_get(p, 0);
+   switch (n) {
+      case 0x30: // F2XM1
+         fpu_set(p, 0, fpu_result(p, expm1l(a * 0.69314718055994530942L), a, 0.0L));
+         return;
+      case 0x31: // FYL2X
+      {
+         const long double b = fpu_get(p, 1);
+         if (a == 0.0L)
+            fpu_exception(p, FPU_ZE);
+         fpu_set(p, 1, fpu_result(p, b * log2l(a), a, b));
+         fpu_pop(p);
+         return;
+      }
+      case 0x32: // FPTAN
+         fpu_set(p, 0, fpu_result(p, tanl(a), a, 0.0L));
+         fpu_push(p, 1.0L);
+         return;
+      case 0x33: // FPATAN
+      {
+         const long double b = fpu_get(p, 1);
+         fpu_set(p, 1, fpu_result(p, atan2l(b, a), a, b));
+         fpu_pop(p);
+         return;
+      }
+      case 0x34: // FXTRACT
+         if (a == 0.0L) {
+            fpu_exception(p, FPU_ZE);
+            fpu_set(p, 0, -(long double)INFINITY);
+            fpu_push(p, a);
+         } else if (isfinite(a)) {
+            const long double e = logbl(a);
+            fpu_set(p, 0, e);
+            fpu_push(p, ldexpl(a, -(int)e));
+         }
+         return;
+      case 0x36: // FDECSTP
+         fpu_set_top(&p->fpu, FPU_TOP(&p->fpu) - 1);
+         return;
+      case 0x37: // FINCSTP
+         fpu_set_top(&p->fpu, FPU_TOP(&p->fpu) + 1);
+         return;
+      case 0x38: // FPREM
+      {
+         const long double b = fpu_get(p, 1);
+         const long double r = fmodl(a, b);
+         p->fpu.status &= ~FPU_CC;
+         if (!isnan(r)) {
+            const uint64_t q = (uint64_t)fmodl(fabsl(truncl((a - r) / b)), 8.0L);
+            p->fpu.status |= ((q & 4) ? FPU_C0 : 0) | ((q & 2) ? FPU_C3 : 0) | ((q & 1) ? FPU_C1 : 0);
+         }
+         fpu_set(p, 0, fpu_result(p, r, a, b));
+         return;
+      }
+      case 0x39: // FYL2XP1
+      {
+         const long double b = fpu_get(p, 1);
+         fpu_set(p, 1, fpu_result(p, b * log1pl(a) * 1.44269504088896340736L, a, b));
+         fpu_pop(p);
+         return;
+      }
+      case 0x3A: // FSQRT
+         fpu_set(p, 0, fpu_result(p, sqrtl(a), a, 0.0L));
+         return;
+      case 0x3C: // FRNDINT
+         if (isfinite(a))
+            fpu_set(p, 0, fpu_round(p, a));
+         return;
+      case 0x3D: // FSCALE
+      {
+         const long double b = truncl(fpu_get(p, 1));
+         if (isnan(b)) {
+            fpu_set(p, 0, b);
+         } else {
+            const int e = (b > 65536.0L) ? 65536 : ((b < -65536.0L) ? -65536 : (int)b);
+            fpu_set(p, 0, fpu_result(p, ldexpl(a, e), a, b));
+         }
+         return;
+      }
+   }
+}
+
+static void fpu_register(CONSTSP(cpu) p) {
+   CONSTSP(fpu) f = &p->fpu;
+   const int op = p->mode.reg;
+   const int i = p->mode.rm;
+
+   switch (p->opcode) {
+      case 0xD8:
+         fpu_arith(p, op, 0, fpu_get(p, i));
+         return;
+      case 0xD9:
+         switch (op) {
+            case 0: // FLD ST(i)
+               fpu_push(p, fpu_get(p, i));
+               return;
+            case 1: // FXCH ST(i)
+            {
+               const long double a = fpu_get(p, 0);
+               const long double b = fpu_get(p, i);
+               fpu_set(p, 0, b);
+               fpu_set(p, i, a);
+               return;
+            }
+            case 3: // FSTP ST(i) (undocumented)
+               fpu_set(p, i, fpu_get(p, 0));
+               fpu_pop(p);
+               return;
+            case 4:
+               if (i == 0) { // FCHS
+                  fpu_set(p, 0, -fpu_get(p, 0));
+               } else if (i == 1) { // FABS
+                  fpu_set(p, 0, fabsl(fpu_get(p, 0)));
+               } else if (i == 4) { // FTST
+                  fpu_compare(p, fpu_get(p, 0), 0.0L);
+               } else if (i == 5) { // FXAM
+                  fpu_examine(p);
+               }
+               return;
+            case 5:
+               fpu_constant(p, i);
+               return;
+            case 6:
+            case 7:
+               fpu_transcendental(p, p->mode.modregrm & 0x3F);
+               return;
+         }
+         return;
+      case 0xDB:
+         if (op == 4) {
+            switch (i) {
+               case 0: f->control &= ~FPU_IEM; return; // FENI
+               case 1: f->control |= FPU_IEM; return;  // FDISI
+               case 2: f->status &= 0x7F00; return;    // FCLEX
+               case 3: fpu_reset(p); return;           // FINIT
+            }
+         }
+         return;
+      case 0xDC:
+         if ((op == 2) || (op == 3)) // FCOM/FCOMP ST(i) (undocumented)
+            fpu_arith(p, op, 0, fpu_get(p, i));
+         else
+            fpu_arith(p, (op < 4) ? op : (op ^ 1), i, fpu_get(p, 0));
+         return;
+      case 0xDD:
+         switch (op) {
+            case 0: // FFREE ST(i)
+               fpu_set_tag(f, i, FPU_TAG_EMPTY);
+               return;
+            case 2: // FST ST(i)
+               fpu_set(p, i, fpu_get(p, 0));
+               return;
+            case 3: // FSTP ST(i)
+               fpu_set(p, i, fpu_get(p, 0));
+               fpu_pop(p);
+               return;
+         }
+         return;
+      case 0xDE:
+         if (op == 3) {
+            if (i == 1) { // FCOMPP
+               fpu_compare(p, fpu_get(p, 0), fpu_get(p, 1));
+               fpu_pop(p);
+               fpu_pop(p);
+            }
+            return;
+         }
+         if (op == 2) // FCOMP ST(i) (undocumented)
+            fpu_arith(p, op, 0, fpu_get(p, i));
+         else
+            fpu_arith(p, (op < 4) ? op : (op ^ 1), i, fpu_get(p, 0));
+         fpu_pop(p);
+         return;
+      case 0xDF:
+         if ((op == 4) && (i == 0) && (p->s->cpu_model == VXT_CPU_80286)) { // FSTSW AX
+            p->regs.ax = f->status;
+            VALIDATOR_DISCARD(p);
+         }
+         return;
+   }
+}
+
+// Control instructions don't update the instruction and operand pointers.
+static bool fpu_control(CONSTSP(cpu) p) {
+   if (MOD_TARGET_MEM(p->mode))
+      return ((p->opcode == 0xD9) || (p->opcode == 0xDD)) && (p->mode.reg >= 4);
+   return ((p->opcode == 0xDB) || (p->opcode == 0xDF)) && (p->mode.reg == 4);
+}
+
+static void fpu_esc(CONSTSP(cpu) p) {
+   VALIDATOR_DISCARD(p);
+
+   if (!p->has_fpu) {
+      // 286 only
+      call_int(p, 7);
+      return;
+   }
+
+   // The FPU registers are not part of the idle loop signature.
+   p->side_effect = true;
+
+   CONSTSP(fpu) f = &p->fpu;
+   const bool control = fpu_control(p);
+   if (!control) {
+      f->ip = VXT_POINTER(p->regs.cs, p->inst_start);
+      f->opcode = ((p->opcode & 7) << 8) | p->mode.modregrm;
+   }
+
+   if (MOD_TARGET_MEM(p->mode)) {
+      const vxt_word offset = get_ea_offset(p);
+      if (!control)
+         f->dp = VXT_POINTER(p->seg, offset);
+      fpu_memory(p, offset);
+   } else {
+      fpu_register(p);
+   }
+
+   if (f->status & ~f->control & FPU_EXCEPTIONS)
+      f->status |= FPU_ES;
+   else
+      f->status &= ~FPU_ES;
+
+   // Unmasked exceptions are reported through the NMI on the PC/XT, if port A0h allows it.
+   cpu_update_nmi(p, p->nmi_enabled, (f->status & FPU_ES) && !(f->control & FPU_IEM));
+}
+
+#endif
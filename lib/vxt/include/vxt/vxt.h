@@ -27,7 +27,7 @@ extern "C" {
 #endif
 
 #define VXT_VERSION_MAJOR 1
-#define VXT_VERSION_MINOR 2
+#define VXT_VERSION_MINOR 3
 #define VXT_VERSION_PATCH 0
 
 #ifdef VXT_VERSION_RELEASE
@@ -200,9 +200,35 @@ struct vxt_step {
     int cycles;
     bool halted, invalid;
     bool interrupt, int28;
+    bool idle;
     vxt_error err;
 };
 
+struct vxt_idle_stats {
+    unsigned long long loops;   // Idle loops that were fast-forwarded.
+    unsigned long long halts;   // HLT states that were fast-forwarded.
+    unsigned long long cycles;  // Total number of skipped cycles.
+};
+
+struct vxt_startup_timing {
+    long long install;          // Time spent in the install callback, in units of the startup clock.
+    long long reset;            // Time spent in the reset callback during the last reset.
+};
+
+struct vxt_profile_entry {
+    vxt_pointer addr;           // Physical address of the instruction. Not used for opcode entries.
+    vxt_byte opcode;
+    const char *name;           // Mnemonic from the opcode table.
+    unsigned long long count;   // Number of executions.
+    unsigned long long cycles;  // Cycles spent, including interrupts taken before the instruction.
+};
+
+enum vxt_cpu_model {
+    VXT_CPU_8088,   // Undocumented aliases and POP CS.
+    VXT_CPU_80186,  // 80186 and NEC V20 subset.
+    VXT_CPU_80286   // Real mode only.
+};
+
 enum vxt_pclass {
     VXT_PCLASS_GENERIC  = 0x01,
     VXT_PCLASS_DEBUGGER = 0x02,
@@ -262,6 +288,10 @@ struct vxt_monitor {
         void (*write)(ty*,vxt_pointer,vxt_byte);                    \
     } io;                                                           \
                                                                     \
+    /* The PIC must call vxt_system_set_interrupt_pending */        \
+    /* whenever next() would start or stop returning an IRQ. */     \
+    /* The CPU does not poll next() since version 1.3, so a */      \
+    /* PIC that never calls it never delivers an interrupt. */      \
     struct {                                                        \
         void (*irq)(ty*,int);                                       \
         int (*next)(ty*);                                           \
@@ -271,6 +301,19 @@ struct vxt_monitor {
         vxt_byte (*read)(ty*,vxt_byte);                             \
         void (*write)(ty*,vxt_byte,vxt_byte);                       \
     } dma;                                                          \
+                                                                    \
+    /* Optional 16-bit memory accesses. Only called if both */      \
+    /* bytes are in the same paragraph. */                          \
+    struct {                                                        \
+        vxt_word (*read16)(ty*,vxt_pointer);                        \
+        void (*write16)(ty*,vxt_pointer,vxt_word);                  \
+    } io16;                                                         \
+                                                                    \
+    /* Optional. Cycles until a timer installed with a zero */      \
+    /* interval next has an effect, or a negative value if it */    \
+    /* doesn't depend on time. Without it such timers prevent */    \
+    /* the CPU from being fast-forwarded. */                        \
+    int (*next_event)(ty*,vxt_timer_id);                            \
 }                                                                   \
 
 /// Interface for ISA bus devices.
@@ -336,6 +379,18 @@ VXT_API int vxt_system_frequency(vxt_system *s);
 VXT_API void vxt_system_set_frequency(vxt_system *s, int freq);
 VXT_API void vxt_system_set_a20(vxt_system *s, bool enable);
 VXT_API void vxt_system_set_tracer(vxt_system *s, void (*tracer)(vxt_system*,vxt_pointer,vxt_byte));
+VXT_API void vxt_system_set_decode_cache(vxt_system *s, bool enable);
+VXT_API void vxt_system_set_cpu_model(vxt_system *s, enum vxt_cpu_model model);
+VXT_API void vxt_system_set_fpu(vxt_system *s, bool enable);
+VXT_API void vxt_system_set_idle_detection(vxt_system *s, bool enable);
+VXT_API struct vxt_idle_stats vxt_system_idle_stats(vxt_system *s);
+VXT_API void vxt_system_set_startup_clock(vxt_system *s, long long (*clock)(void));
+VXT_API struct vxt_startup_timing vxt_system_startup_timing(vxt_system *s, vxt_byte idx);
+VXT_API void vxt_system_set_profiler(vxt_system *s, bool enable);
+VXT_API void vxt_system_clear_profiler(vxt_system *s);
+VXT_API int vxt_system_profile_opcodes(vxt_system *s, struct vxt_profile_entry *entries, int max);
+VXT_API int vxt_system_profile_addresses(vxt_system *s, struct vxt_profile_entry *entries, int max);
+VXT_API int vxt_system_profile_stack(vxt_system *s, vxt_pointer *frames, int max);
 VXT_API void vxt_system_set_validator(vxt_system *s, const struct vxt_validator *intrf);
 VXT_API void vxt_system_set_userdata(vxt_system *s, void *data);
 VXT_API void *vxt_system_userdata(vxt_system *s);
@@ -353,17 +408,24 @@ VXT_API void *vxt_peripheral_device(const struct vxt_peripheral *p);
 VXT_API vxt_system *vxt_peripheral_system(const struct vxt_peripheral *p);
 
 VXT_API void vxt_system_interrupt(vxt_system *s, int n);
+VXT_API void vxt_system_set_nmi(vxt_system *s, bool enable);
+VXT_API void vxt_system_set_interrupt_pending(vxt_system *s, bool pending);
 VXT_API void vxt_system_wait(vxt_system *s, int cycles);
 
 VXT_API void vxt_system_install_io_at(vxt_system *s, struct vxt_peripheral *dev, vxt_word addr);
 VXT_API void vxt_system_install_io(vxt_system *s, struct vxt_peripheral *dev, vxt_word from, vxt_word to);
 VXT_API void vxt_system_install_mem(vxt_system *s, struct vxt_peripheral *dev, vxt_pointer from, vxt_pointer to);
+VXT_API void vxt_system_map_mem_pointer(vxt_system *s, struct vxt_peripheral *dev, vxt_pointer from, vxt_pointer to, vxt_byte *data, bool read_only);
 VXT_API vxt_timer_id vxt_system_install_timer(vxt_system *s, struct vxt_peripheral *dev, unsigned int us);
 VXT_API bool vxt_system_set_timer_interval(vxt_system *s, vxt_timer_id id, unsigned int us);
 VXT_API void vxt_system_install_monitor(vxt_system *s, struct vxt_peripheral *dev, const char *name, void *reg, enum vxt_monitor_flag flags);
 
 VXT_API vxt_byte vxt_system_read_byte(vxt_system *s, vxt_pointer addr);
 VXT_API void vxt_system_write_byte(vxt_system *s, vxt_pointer addr, vxt_byte data);
+VXT_API vxt_word vxt_system_read_word(vxt_system *s, vxt_pointer addr);
+VXT_API void vxt_system_write_word(vxt_system *s, vxt_pointer addr, vxt_word data);
+VXT_API void vxt_system_read_block(vxt_system *s, vxt_pointer addr, vxt_byte *data, int size);
+VXT_API void vxt_system_write_block(vxt_system *s, vxt_pointer addr, const vxt_byte *data, int size);
 
 /// @private
 _Static_assert(sizeof(vxt_pointer) == 4 && sizeof(vxt_int32) == 4, "invalid integer size");
@@ -35,16 +35,6 @@ extern "C" {
 	#define VXTU_CAST(in, tin, tout) ( ((VXT_PACK(union { tin from; tout to; })){ .from = (in) }).to )
 #endif
 
-#define vxtu_randomize(ptr, size, seed) {					\
-    int s = (int)(seed);									\
-    for (int i = 0; i < (int)(size); i++) {					\
-        const int m = 2147483647;							\
-        s = (16807 * s) % m;								\
-        float r = (float)s / m;								\
-        ((vxt_byte*)(ptr))[i] = (vxt_byte)(255.0 * r);		\
-    }														\
-}															\
-
 typedef struct vxt_peripheral *(*vxtu_module_entry_func)(vxt_allocator*,void*,const char*);
 
 #ifdef VXTU_MODULES
@@ -210,11 +200,16 @@ struct vxtu_disk_interface {
 	int (*tell)(vxt_system *s, void *fp);
 };
 
+VXT_API void vxtu_randomize(void *ptr, int size, intptr_t seed);
 VXT_API vxt_byte *vxtu_read_file(vxt_allocator *alloc, const char *file, int *size);
+VXT_API void *vxtu_map_file(const char *file, int *size);
+VXT_API void vxtu_unmap_file(void *mapping, int size);
 
 VXT_API struct vxt_peripheral *vxtu_memory_create(vxt_allocator *alloc, vxt_pointer base, int amount, bool read_only);
 VXT_API void *vxtu_memory_internal_pointer(struct vxt_peripheral *p);
 VXT_API bool vxtu_memory_device_fill(struct vxt_peripheral *p, const vxt_byte *data, int size);
+VXT_API struct vxt_peripheral *vxtu_rom_create(vxt_allocator *alloc, vxt_pointer base, const vxt_byte *data, int size);
+VXT_API struct vxt_peripheral *vxtu_rom_map(vxt_allocator *alloc, vxt_pointer base, const char *file);
 
 VXT_API struct vxt_peripheral *vxtu_pic_create(vxt_allocator *alloc);
 
@@ -20,23 +20,74 @@
 //    distribution.
 
 #include "common.h"
+#include "testing.h"
 #include <vxt/vxtu.h>
 
+// RAM is initialized and mapped in chunks the first time the guest touches them. This
+// avoids touching host memory that the guest never uses. Must be a multiple of the system
+// memory page size.
+#define CHUNK_SHIFT 12
+#define CHUNK_MASK ((1 << CHUNK_SHIFT) - 1)
+
 struct memory {
     vxt_pointer base;
     bool read_only;
+    bool installed;
     int size;
-    vxt_byte data[];
+
+    // Points at 'storage' or at external ROM data.
+    vxt_byte *data;
+    // Allocated separately so untouched pages are never faulted in by the host.
+    vxt_byte *storage;
+    // Set if 'data' is a file mapping owned by this device.
+    void *mapping;
+
+    int num_chunks;
+    bool ready[];
 };
 
+static void init_chunk(struct memory *m, int chunk) {
+    const vxt_pointer end = (m->base + (vxt_pointer)m->size) - 1;
+    vxt_pointer from = (m->base & ~CHUNK_MASK) + ((vxt_pointer)chunk << CHUNK_SHIFT);
+    vxt_pointer to = from + CHUNK_MASK;
+    if (from < m->base) from = m->base;
+    if (to > end) to = end;
+
+    if (!m->ready[chunk]) {
+        vxt_byte *ptr = &m->data[from - m->base];
+        #ifdef VXTU_MEMCLEAR
+            memset(ptr, 0, (size_t)(to - from) + 1);
+        #else
+            vxtu_randomize(ptr, (int)(to - from) + 1, (intptr_t)m + chunk);
+        #endif
+        m->ready[chunk] = true;
+    }
+
+    if (m->installed)
+        vxt_system_map_mem_pointer(VXT_GET_SYSTEM(m), VXT_GET_PERIPHERAL(m), from, to, &m->data[from - m->base], m->read_only);
+}
+
+static void init_all_chunks(struct memory *m) {
+    for (int i = 0; i < m->num_chunks; i++) {
+        if (!m->ready[i])
+            init_chunk(m, i);
+    }
+}
+
 static vxt_byte read(struct memory *m, vxt_pointer addr) {
     ENSURE((int)(addr - m->base) < m->size);
+    const int chunk = (int)((addr >> CHUNK_SHIFT) - (m->base >> CHUNK_SHIFT));
+    if (UNLIKELY(!m->ready[chunk]))
+        init_chunk(m, chunk);
     return m->data[addr - m->base];
 }
 
 static void write(struct memory *m, vxt_pointer addr, vxt_byte data) {
     ENSURE((int)(addr - m->base) < m->size);
     if (!m->read_only) {
+        const int chunk = (int)((addr >> CHUNK_SHIFT) - (m->base >> CHUNK_SHIFT));
+        if (UNLIKELY(!m->ready[chunk]))
+            init_chunk(m, chunk);
         m->data[addr - m->base] = data;
     } else {
         VXT_LOG("writing to read-only memory: [0x%X] = 0x%X", addr, data);
@@ -44,7 +95,16 @@ static void write(struct memory *m, vxt_pointer addr, vxt_byte data) {
 }
 
 static vxt_error install(struct memory *m, vxt_system *s) {
-    vxt_system_install_mem(s, VXT_GET_PERIPHERAL(m), m->base, (m->base + (vxt_pointer)m->size) - 1);
+    struct vxt_peripheral *p = VXT_GET_PERIPHERAL(m);
+    const vxt_pointer to = (m->base + (vxt_pointer)m->size) - 1;
+
+    vxt_system_install_mem(s, p, m->base, to);
+    m->installed = true;
+
+    for (int i = 0; i < m->num_chunks; i++) {
+        if (m->ready[i])
+            init_chunk(m, i);
+    }
     return VXT_NO_ERROR;
 }
 
@@ -52,21 +112,38 @@ static const char *name(struct memory *m) {
     return m->read_only ? "ROM" : "RAM";
 }
 
-VXT_API struct vxt_peripheral *vxtu_memory_create(vxt_allocator *alloc, vxt_pointer base, int amount, bool read_only) {
-    struct VXT_PERIPHERAL(struct memory) *PERIPHERAL;
-    *(void**)&PERIPHERAL = (void*)vxt_allocate_peripheral((alloc), sizeof(struct memory) + amount);
+static vxt_error destroy(struct memory *m) {
+    vxt_allocator *alloc = vxt_system_allocator(VXT_GET_SYSTEM(m));
+    if (m->mapping)
+        vxtu_unmap_file(m->mapping, m->size);
+    if (m->storage)
+        alloc(m->storage, 0);
+    alloc(VXT_GET_PERIPHERAL(m), 0);
+    return VXT_NO_ERROR;
+}
 
-    struct memory *mem = VXT_GET_DEVICE(memory, PERIPHERAL);
+static struct vxt_peripheral *create(vxt_allocator *alloc, vxt_pointer base, int amount, vxt_byte *data, bool read_only) {
+    const int num_chunks = (int)((((base + (vxt_pointer)amount) - 1) >> CHUNK_SHIFT) - (base >> CHUNK_SHIFT)) + 1;
 
-    #ifndef VXTU_MEMCLEAR
-        if (!read_only) vxtu_randomize(mem->data, amount, (intptr_t)PERIPHERAL);
-    #endif
+    struct VXT_PERIPHERAL(struct memory) *PERIPHERAL;
+    *(void**)&PERIPHERAL = (void*)vxt_allocate_peripheral((alloc), sizeof(struct memory) + num_chunks);
 
+    struct memory *mem = VXT_GET_DEVICE(memory, PERIPHERAL);
     mem->base = base;
     mem->read_only = read_only;
     mem->size = amount;
+    mem->num_chunks = num_chunks;
+
+    if (data) {
+        mem->data = data;
+        for (int i = 0; i < num_chunks; i++)
+            mem->ready[i] = true;
+    } else {
+        mem->data = mem->storage = (vxt_byte*)alloc(NULL, amount);
+    }
 
     PERIPHERAL->install = &install;
+    PERIPHERAL->destroy = &destroy;
     PERIPHERAL->name = &name;
     PERIPHERAL->io.read = &read;
     PERIPHERAL->io.write = &write;
@@ -74,16 +151,132 @@ VXT_API struct vxt_peripheral *vxtu_memory_create(vxt_allocator *alloc, vxt_poin
     return (struct vxt_peripheral*)PERIPHERAL;
 }
 
+VXT_API struct vxt_peripheral *vxtu_memory_create(vxt_allocator *alloc, vxt_pointer base, int amount, bool read_only) {
+    struct vxt_peripheral *p = create(alloc, base, amount, NULL, read_only);
+
+    // ROM contents are expected to be filled in by the caller.
+    if (read_only) {
+        struct memory *m = VXT_GET_DEVICE(memory, p);
+        memset(m->data, 0, amount);
+        for (int i = 0; i < m->num_chunks; i++)
+            m->ready[i] = true;
+    }
+    return p;
+}
+
+VXT_API struct vxt_peripheral *vxtu_rom_create(vxt_allocator *alloc, vxt_pointer base, const vxt_byte *data, int size) {
+    ENSURE(data && (size > 0));
+
+    // The guest can never write through a read-only mapping so dropping const is safe.
+    return create(alloc, base, size, (vxt_byte*)data, true);
+}
+
+VXT_API struct vxt_peripheral *vxtu_rom_map(vxt_allocator *alloc, vxt_pointer base, const char *file) {
+    int size = 0;
+    void *mapping = vxtu_map_file(file, &size);
+    if (!mapping)
+        return NULL;
+
+    struct vxt_peripheral *p = vxtu_rom_create(alloc, base, (const vxt_byte*)mapping, size);
+    VXT_GET_DEVICE(memory, p)->mapping = mapping;
+    return p;
+}
+
 VXT_API void *vxtu_memory_internal_pointer(struct vxt_peripheral *p) {
-    return VXT_GET_DEVICE(memory, p)->data;
+    // The caller can access any part of the memory so it all has to be initialized.
+    struct memory *m = VXT_GET_DEVICE(memory, p);
+    init_all_chunks(m);
+    return m->data;
 }
 
 VXT_API bool vxtu_memory_device_fill(struct vxt_peripheral *p, const vxt_byte *data, int size) {
     struct memory *m = VXT_GET_DEVICE(memory, p);
     ENSURE(data);
-    if (m->size < size)
+    if ((m->size < size) || !m->storage)
         return false;
-    for (int i = 0; i < size; i++)
-        m->data[i] = data[i];
+    init_all_chunks(m);
+    memcpy(m->data, data, size);
     return true;
 }
+
+#ifdef TESTING
+    static vxt_byte test_rom_data[0x800];
+
+    static int test_rom_map_file(struct Test T, const char *path) {
+        struct vxt_peripheral *devices[3] = {0};
+        devices[0] = vxtu_rom_create(TALLOC, 0xFF000, test_rom_data, sizeof(test_rom_data));
+        devices[1] = vxtu_rom_map(TALLOC, 0xFE000, path);
+        TENSURE(devices[1] && !vxtu_rom_map(TALLOC, 0xFD000, "test_rom_missing.bin"));
+        TENSURE(!vxtu_memory_device_fill(devices[0], test_rom_data, 1));
+
+        vxt_system *s = vxt_system_create(TALLOC, VXT_DEFAULT_FREQUENCY, devices);
+        TENSURE(s);
+        TENSURE_NO_ERR(vxt_system_initialize(s));
+        TENSURE(vxtu_memory_internal_pointer(devices[0]) == test_rom_data);
+
+        for (int i = 0; i < 0x800; i++)
+            TENSURE(vxt_system_read_byte(s, 0xFF000 + i) == test_rom_data[i]);
+        for (int i = 0; i < 0x1000; i++)
+            TENSURE(vxt_system_read_byte(s, 0xFE000 + i) == (vxt_byte)~i);
+
+        vxt_system_write_byte(s, 0xFE000, 0);
+        vxt_system_write_byte(s, 0xFF000, 1);
+        TENSURE(vxt_system_read_byte(s, 0xFE000) == 0xFF && test_rom_data[0] == 0);
+
+        vxt_system_destroy(s);
+        return 0;
+    }
+#endif
+
+TEST(rom_map,
+    const char *dir = getenv("TMPDIR") ? getenv("TMPDIR") : (getenv("TEMP") ? getenv("TEMP") : "/tmp");
+    char path[512];
+    TENSURE(snprintf(path, sizeof(path), "%s/vxt_test_rom_map.bin", dir) < (int)sizeof(path));
+
+    for (int i = 0; i < 0x1000; i++)
+        test_rom_data[i & 0x7FF] = (vxt_byte)(i * 3);
+
+    FILE *fp = fopen(path, "wb");
+    TENSURE(fp);
+    for (int i = 0; i < 0x1000; i++)
+        fputc((vxt_byte)~i, fp);
+    fclose(fp);
+
+    // The file is removed on every exit path, even if an assertion fails.
+    const int res = test_rom_map_file(T, path);
+    remove(path);
+    TENSURE(res == 0);
+)
+
+#ifdef TESTING
+    static long long test_clock_ticks;
+    static long long test_clock(void) { return ++test_clock_ticks; }
+#endif
+
+TEST(lazy_ram,
+    struct vxt_peripheral *devices[2] = {0};
+    devices[0] = vxtu_memory_create(TALLOC, 0x800, 0x10000, false);
+    vxt_system *s = vxt_system_create(TALLOC, VXT_DEFAULT_FREQUENCY, devices);
+    TENSURE(s);
+    vxt_system_set_startup_clock(s, &test_clock);
+    TENSURE_NO_ERR(vxt_system_initialize(s));
+    vxt_system_reset(s);
+    TENSURE(vxt_system_startup_timing(s, 1).install > 0);
+
+    struct memory *m = VXT_GET_DEVICE(memory, devices[0]);
+    TENSURE(m->num_chunks == 17);
+    for (int i = 0; i < m->num_chunks; i++)
+        TENSURE(!m->ready[i]);
+
+    // Crosses a chunk boundary.
+    vxt_system_write_word(s, 0x1FFF, 0x1234);
+    TENSURE(!m->ready[0] && m->ready[1] && m->ready[2] && !m->ready[3]);
+    TENSURE(vxt_system_read_word(s, 0x1FFF) == 0x1234);
+
+    const vxt_byte *mem = (const vxt_byte*)vxtu_memory_internal_pointer(devices[0]);
+    TENSURE(m->ready[0] && m->ready[16]);
+    TENSURE(mem[0x17FF] == 0x34 && mem[0x1800] == 0x12);
+    TENSURE(vxt_system_read_word(s, 0x1FFF) == 0x1234);
+
+    vxt_system_destroy(s);
+)
@@ -244,14 +244,14 @@ static struct instruction const opcode_table[0x100] = {
    {0xD5, "AAD I0", false, 60, ARCH_8086, &aad_D5},
    {0xD6, "SALC", false, X, ARCH_8086, &salc_D6},
    {0xD7, "XLAT", false, 11, ARCH_8086, &xlat_D7},
-   {0xD8, "ESC", true, X, ARCH_FPU, &fpu_dummy},
-   {0xD9, "ESC", true, X, ARCH_FPU, &fpu_dummy},
-   {0xDA, "ESC", true, X, ARCH_FPU, &fpu_dummy},
-   {0xDB, "ESC", true, X, ARCH_FPU, &fpu_dummy},
-   {0xDC, "ESC", true, X, ARCH_FPU, &fpu_dummy},
-   {0xDD, "ESC", true, X, ARCH_FPU, &fpu_dummy},
-   {0xDE, "ESC", true, X, ARCH_FPU, &fpu_dummy},
-   {0xDF, "ESC", true, X, ARCH_FPU, &fpu_dummy},
+   {0xD8, "ESC", true, X, ARCH_FPU, &fpu_esc},
+   {0xD9, "ESC", true, X, ARCH_FPU, &fpu_esc},
+   {0xDA, "ESC", true, X, ARCH_FPU, &fpu_esc},
+   {0xDB, "ESC", true, X, ARCH_FPU, &fpu_esc},
+   {0xDC, "ESC", true, X, ARCH_FPU, &fpu_esc},
+   {0xDD, "ESC", true, X, ARCH_FPU, &fpu_esc},
+   {0xDE, "ESC", true, X, ARCH_FPU, &fpu_esc},
+   {0xDF, "ESC", true, X, ARCH_FPU, &fpu_esc},
    {0xE0, "LOOPNZ Jb", false, 0, ARCH_8086, &loopnz_E0},
    {0xE1, "LOOPZ Jb", false, 0, ARCH_8086, &loopz_E1},
    {0xE2, "LOOP Jb", false, 0, ARCH_8086, &loop_E2},
@@ -286,5 +286,9 @@ static struct instruction const opcode_table[0x100] = {
    {0xFF, "GRP5 Ev", true, 0, ARCH_8086, &grp5_FF}
 };
 
+// Replacements used by cpu_set_model.
+static struct instruction const pop_cs_instruction = {0xF, "POP CS", false, 8, ARCH_8086, &pop_cs_0F};
+static struct instruction const invalid_instruction = {0x0, INVALID};
+
 #undef INVALID
 #undef X
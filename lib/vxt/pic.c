@@ -20,6 +20,7 @@
 //    distribution.
 
 #include <vxt/vxtu.h>
+#include "testing.h"
 
 struct pic {
 	vxt_byte mask_reg;
@@ -40,7 +41,11 @@ static vxt_byte in(struct pic *c, vxt_word port) {
 	return 0;
 }
 
-static void out(struct pic *c, vxt_word port, vxt_byte data) {
+static void update_pending(struct pic *c) {
+    vxt_system_set_interrupt_pending(VXT_GET_SYSTEM(c), (c->request_reg & ~c->mask_reg & ~c->service_reg) != 0);
+}
+
+static void write_reg(struct pic *c, vxt_word port, vxt_byte data) {
 	switch (port) {
         case 0x20:
             if (data & 0x10) {
@@ -76,6 +81,11 @@ static void out(struct pic *c, vxt_word port, vxt_byte data) {
 	}
 }
 
+static void out(struct pic *c, vxt_word port, vxt_byte data) {
+    write_reg(c, port, data);
+    update_pending(c);
+}
+
 static int next(struct pic *c) {
     vxt_byte has = c->request_reg & (~c->mask_reg);
 
@@ -90,6 +100,8 @@ static int next(struct pic *c) {
 
             if (!(c->icw[4] & 2)) // Not auto EOI?
                 c->service_reg |= mask;
+
+            update_pending(c);
             return (int)c->icw[2] + i;
         }
     }
@@ -98,6 +110,7 @@ static int next(struct pic *c) {
 
 static void irq(struct pic *c, int n) {
     c->request_reg |= (vxt_byte)(1 << n);
+    update_pending(c);
 }
 
 static vxt_error install(struct pic *c, vxt_system *s) {
@@ -110,6 +123,7 @@ static vxt_error reset(struct pic *c, struct pic *state) {
         memcpy(c, state, sizeof(struct pic));
     else
         vxt_memclear(c, sizeof(struct pic));
+    update_pending(c);
     return VXT_NO_ERROR;
 }
 
@@ -131,3 +145,72 @@ VXT_API struct vxt_peripheral *vxtu_pic_create(vxt_allocator *alloc) VXT_PERIPHE
     PERIPHERAL->pic.next = &next;
     PERIPHERAL->pic.irq = &irq;
 })
+
+#ifdef TESTING
+    #include <string.h>
+    #include <time.h>
+
+    static const vxt_byte test_pic_code[] = {
+        0xB0, 0x13, 0xE6, 0x20, // MOV AL,0x13 / OUT 0x20,AL (ICW1)
+        0xB0, 0x08, 0xE6, 0x21, // MOV AL,0x08 / OUT 0x21,AL (ICW2)
+        0xB0, 0x09, 0xE6, 0x21, // MOV AL,0x09 / OUT 0x21,AL (ICW4)
+        0xB0, 0xFE, 0xE6, 0x21, // MOV AL,0xFE / OUT 0x21,AL (Mask all but IRQ0)
+        0xFB,                   // STI
+        0xEB, 0xFE              // JMP $
+    };
+
+    static const vxt_byte test_pic_handler[] = {
+        0xFE, 0x06, 0x00, 0x03, // INC BYTE [0x300]
+        0xB0, 0x20, 0xE6, 0x20, // MOV AL,0x20 / OUT 0x20,AL (EOI)
+        0xCF                    // IRET
+    };
+#endif
+
+// Checks that only unmasked requests are delivered.
+TEST(pic_pending,
+    vxt_byte *mem;
+    struct vxt_peripheral *devices[2] = {0};
+    devices[0] = vxtu_pic_create(TALLOC);
+    vxt_system *s = test_machine_create(&mem, devices, test_pic_code, sizeof(test_pic_code));
+    TENSURE(s);
+    memcpy(&mem[0x200], test_pic_handler, sizeof(test_pic_handler));
+    mem[0x20] = 0x00; mem[0x21] = 0x02; // INT 8 -> 0000:0200
+
+    struct vxt_registers *regs = vxt_system_registers(s);
+    for (int i = 0; i < 9; i++)
+        vxt_system_step(s, 1);
+    TENSURE(regs->ip == 0x111);
+
+    vxt_system_interrupt(s, 1);
+    for (int i = 0; i < 100; i++)
+        vxt_system_step(s, 1);
+    TENSURE(mem[0x300] == 0);
+
+    vxt_system_interrupt(s, 0);
+    for (int i = 0; i < 100; i++)
+        vxt_system_step(s, 1);
+    TENSURE(mem[0x300] == 1);
+
+    test_machine_destroy(s, mem);
+)
+
+// Measures the cost per instruction while a masked request is pending.
+BENCH(pic_pending,
+    vxt_byte *mem;
+    struct vxt_peripheral *devices[2] = {0};
+    devices[0] = vxtu_pic_create(TALLOC);
+    vxt_system *s = test_machine_create(&mem, devices, test_pic_code, sizeof(test_pic_code));
+    TENSURE(s);
+
+    for (int i = 0; i < 9; i++)
+        vxt_system_step(s, 1);
+    vxt_system_interrupt(s, 1);
+
+    const int num = 2000000;
+    const clock_t start = clock();
+    for (int i = 0; i < num; i++)
+        vxt_system_step(s, 1);
+    TLOG("%s: %.1f ns per instruction", T.name, (double)(clock() - start) * 1000000000.0 / CLOCKS_PER_SEC / num);
+
+    test_machine_destroy(s, mem);
+)
@@ -20,6 +20,7 @@
 //    distribution.
 
 #include <vxt/vxtu.h>
+#include "testing.h"
 
 #define PIT_FREQUENCY 1.193182
 #define TOGGLE_HIGH(ch) ( ((ch)->mode == MODE_LATCH_COUNT || (ch)->mode == MODE_TOGGLE) && (ch)->toggle )
@@ -141,6 +142,18 @@ static vxt_error timer(struct pit *c, vxt_timer_id id, int cycles) {
     return VXT_NO_ERROR;
 }
 
+// Only channel 0 raises interrupts. The other channels can always catch up.
+static int next_event(struct pit *c, vxt_timer_id id) {
+    (void)id;
+    const struct channel *ch = &c->channels[0];
+    if (!ch->enabled)
+        return -1;
+
+    const double us = ((double)ch->counter + 1.0) / PIT_FREQUENCY - c->ticker;
+    const double cycles = us * (double)vxt_system_frequency(VXT_GET_SYSTEM(c)) / 1000000.0;
+    return (cycles > 0.0) ? (int)cycles + 1 : 0;
+}
+
 static const char *name(struct pit *c) {
     (void)c; return "PIT (Intel 8253)";
 }
@@ -155,6 +168,7 @@ VXT_API struct vxt_peripheral *vxtu_pit_create(vxt_allocator *alloc) VXT_PERIPHE
     PERIPHERAL->pclass = &pclass;
     PERIPHERAL->reset = &reset;
     PERIPHERAL->timer = &timer;
+    PERIPHERAL->next_event = &next_event;
     PERIPHERAL->io.in = &in;
     PERIPHERAL->io.out = &out;
 })
@@ -167,3 +181,62 @@ VXT_API double vxtu_pit_get_frequency(struct vxt_peripheral *p, int channel) {
     if (fd == 0.0) fd = (double)0x10000;
     return (PIT_FREQUENCY * 1000000.0) / (double)fd;
 }
+
+#ifdef TESTING
+    static const vxt_byte test_pit_code[] = {
+        0xB0, 0x13, 0xE6, 0x20, // MOV AL,0x13 / OUT 0x20,AL (ICW1)
+        0xB0, 0x08, 0xE6, 0x21, // MOV AL,0x08 / OUT 0x21,AL (ICW2)
+        0xB0, 0x09, 0xE6, 0x21, // MOV AL,0x09 / OUT 0x21,AL (ICW4)
+        0xB0, 0xFE, 0xE6, 0x21, // MOV AL,0xFE / OUT 0x21,AL (Mask all but IRQ0)
+        0xB0, 0x34, 0xE6, 0x43, // MOV AL,0x34 / OUT 0x43,AL (Channel 0, low/high byte)
+        0xB0, 0xE8, 0xE6, 0x40, // MOV AL,0xE8 / OUT 0x40,AL
+        0xB0, 0x03, 0xE6, 0x40, // MOV AL,0x03 / OUT 0x40,AL (1000 ticks)
+        0xFB,                   // STI
+        0xF4,                   // HLT
+        0xEB, 0xFD              // JMP -3
+    };
+
+    static const vxt_byte test_pit_handler[] = {
+        0xFE, 0x06, 0x00, 0x03, // INC BYTE [0x300]
+        0xB0, 0x20, 0xE6, 0x20, // MOV AL,0x20 / OUT 0x20,AL (EOI)
+        0xCF                    // IRET
+    };
+
+    // The last run uses the 1 ms steps of the SDL2 frontend.
+    static const int test_pit_budgets[4] = {1, 20000, 1000, VXT_DEFAULT_FREQUENCY / 1000};
+#endif
+
+// A halted CPU is fast-forwarded to the next channel 0 interrupt, or the end of the step,
+// and gets as many interrupts as when it is stepped one instruction at a time.
+TEST(pit_halt,
+    int irqs[4] = {0};
+    for (int i = 0; i < 4; i++) {
+        vxt_byte *mem;
+        struct vxt_peripheral *devices[3] = {0};
+        devices[0] = vxtu_pic_create(TALLOC);
+        devices[1] = vxtu_pit_create(TALLOC);
+        vxt_system *s = test_machine_create(&mem, devices, test_pit_code, sizeof(test_pit_code));
+        TENSURE(s);
+        memcpy(&mem[0x200], test_pit_handler, sizeof(test_pit_handler));
+        mem[0x20] = 0x00; mem[0x21] = 0x02; // INT 8 -> 0000:0200
+
+        const int budget = test_pit_budgets[i];
+        vxt_system_set_idle_detection(s, i >= 2);
+        for (int cycles = 0; cycles < 200000;) {
+            const struct vxt_step res = vxt_system_step(s, budget);
+            TENSURE_NO_ERR(res.err);
+            TENSURE(res.cycles < budget + 200);
+            cycles += res.cycles;
+        }
+        irqs[i] = mem[0x300];
+
+        const struct vxt_idle_stats stats = vxt_system_idle_stats(s);
+        TENSURE(i ? (stats.halts > 0 && stats.cycles > 150000) : !stats.halts);
+        test_machine_destroy(s, mem);
+    }
+
+    // About 4000 cycles per interrupt at the default frequency.
+    TENSURE(irqs[0] >= 45 && irqs[0] <= 55);
+    for (int i = 1; i < 4; i++)
+        TENSURE((irqs[i] >= irqs[0] - 1) && (irqs[i] <= irqs[0] + 1));
+)
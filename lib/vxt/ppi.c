@@ -20,6 +20,7 @@
 //    distribution.
 
 #include <vxt/vxtu.h>
+#include "testing.h"
 
 #ifndef VXTU_PPI_TONE_VOLUME
     #define VXTU_PPI_TONE_VOLUME 8192
@@ -96,12 +97,15 @@ static void out(struct ppi *c, vxt_word port, vxt_byte data) {
         }
         
         c->port_61 = data;
+    } else if (port == 0xA0) {
+        vxt_system_set_nmi(VXT_GET_SYSTEM(c), (data & 0x80) != 0);
     }
 }
 
 static vxt_error install(struct ppi *c, vxt_system *s) {
     struct vxt_peripheral *p = VXT_GET_PERIPHERAL(c);
     vxt_system_install_io(s, p, 0x60, 0x63);
+    vxt_system_install_io_at(s, p, 0xA0); // NMI mask register
     vxt_system_install_timer(s, p, 1000);
 
     for (int i = 0; i < VXT_MAX_PERIPHERALS; i++) {
@@ -209,3 +213,53 @@ VXT_API void vxtu_ppi_set_xt_switches(struct vxt_peripheral *p, vxt_byte data) {
 VXT_API vxt_byte vxtu_ppi_xt_switches(struct vxt_peripheral *p) {
     return (VXT_GET_DEVICE(ppi, p))->xt_switches;
 }
+
+#ifdef TESTING
+    static const vxt_byte test_nmi_code[] = {
+        0xDB, 0xE3,             // FINIT
+        0xD9, 0x2E, 0x00, 0x02, // FLDCW [0x200] (Unmask invalid operation)
+        0xD9, 0xC1,             // FLD ST(1) (Stack underflow)
+        0x90,                   // NOP
+        0xB0, 0x80, 0xE6, 0xA0, // MOV AL,0x80 / OUT 0xA0,AL (Enable NMI)
+        0xF4,                   // HLT
+        0xEB, 0xFD              // JMP -3
+    };
+
+    static const vxt_byte test_nmi_handler[] = {
+        0xFE, 0x06, 0x00, 0x04, // INC BYTE [0x400]
+        0xCF                    // IRET
+    };
+#endif
+
+// An unmasked 8087 exception only reaches the CPU as an NMI once port A0h enables it.
+TEST(nmi_mask,
+    vxt_byte *mem;
+    struct vxt_peripheral *devices[3] = {0};
+    devices[0] = vxtu_pit_create(TALLOC);
+    devices[1] = vxtu_ppi_create(TALLOC);
+    vxt_system *s = test_machine_create(&mem, devices, test_nmi_code, sizeof(test_nmi_code));
+    TENSURE(s);
+    vxt_system_set_fpu(s, true);
+
+    memcpy(&mem[0x300], test_nmi_handler, sizeof(test_nmi_handler));
+    mem[0x8] = 0x00; mem[0x9] = 0x03; // NMI -> 0000:0300
+    mem[0x200] = 0x7E; mem[0x201] = 0x03;
+
+    struct vxt_registers *r = vxt_system_registers(s);
+    while (r->ip != 0x10B)
+        TENSURE_NO_ERR(vxt_system_step(s, 1).err);
+    TENSURE(mem[0x400] == 0);
+
+    for (int i = 0; i < 100; i++)
+        TENSURE_NO_ERR(vxt_system_step(s, 1).err);
+    TENSURE((mem[0x400] == 1) && (r->ip == 0x10E));
+
+    // The NMI is edge triggered so the pending 8087 error is raised again when it is re-enabled.
+    vxt_system_set_nmi(s, false);
+    vxt_system_set_nmi(s, true);
+    for (int i = 0; i < 100; i++)
+        TENSURE_NO_ERR(vxt_system_step(s, 1).err);
+    TENSURE((mem[0x400] == 2) && (r->ip == 0x10E));
+
+    test_machine_destroy(s, mem);
+)
@@ -22,6 +22,226 @@
 #include "common.h"
 #include "exec.h"
 
+#if !defined(VXT_NO_SIMD) && (defined(__AVX2__) || defined(__SSE2__))
+   #include <immintrin.h>
+#endif
+
+// Number of elements, at most n, that can be accessed from seg:off in the current direction
+// without a segment wrap or crossing into another page. Also returns a host pointer to the first element.
+static int bulk_span(CONSTSP(cpu) p, vxt_word seg, vxt_word off, int size, int n, bool write, vxt_byte **ptr) {
+   vxt_pointer addr = VXT_POINTER(seg, off);
+   const int offset = addr & MEM_PAGE_MASK;
+   int room;
+
+   if (p->regs.flags & VXT_DIRECTION) {
+      if (((off + size) > 0x10000) || ((offset + size) > MEM_PAGE_SIZE))
+         return 0;
+      room = ((off < offset) ? off : offset) / size + 1;
+   } else {
+      const int left = MEM_PAGE_SIZE - offset;
+      room = (((0x10000 - off) < left) ? (0x10000 - off) : left) / size;
+   }
+   if (room < n)
+      n = room;
+
+   addr &= p->s->a20_mask;
+   if (!n || (addr >= MEM_SPACE_SIZE))
+      return 0;
+
+   const struct mem_page *mp = &p->s->mem_pages[addr >> MEM_PAGE_SHIFT];
+   vxt_byte *page = write ? mp->write : mp->read;
+   if (!page)
+      return 0;
+
+   // Bulk writes are not part of the write hash.
+   if (write)
+      p->side_effect = true;
+
+   *ptr = &page[offset];
+   return n;
+}
+
+static int bulk_movs(CONSTSP(cpu) p, int size, int cycle) {
+   vxt_byte *src, *dst;
+   int n = bulk_span(p, p->seg, p->regs.si, size, p->regs.cx, false, &src);
+   if (n)
+      n = bulk_span(p, p->regs.es, p->regs.di, size, n, true, &dst);
+   if (!n)
+      return 0;
+
+   const int len = n * size;
+   if (p->regs.flags & VXT_DIRECTION) {
+      src -= len - size;
+      dst -= len - size;
+      // Overlapping copies that repeat a pattern needs to be done one element at the time.
+      if ((dst < src) && (src < (dst + len)))
+         return 0;
+   } else if ((src < dst) && (dst < (src + len))) {
+      return 0;
+   }
+
+   memmove(dst, src, len);
+   update_di_si(p, (vxt_word)len);
+   p->regs.cx -= n;
+   p->cycles += n * cycle;
+   p->bus_transfers += len * 2;
+   return n;
+}
+
+static int bulk_stos(CONSTSP(cpu) p, int size, int cycle) {
+   vxt_byte *dst;
+   const int n = bulk_span(p, p->regs.es, p->regs.di, size, p->regs.cx, true, &dst);
+   if (!n)
+      return 0;
+
+   const int len = n * size;
+   if (p->regs.flags & VXT_DIRECTION)
+      dst -= len - size;
+
+   if (size == 1) {
+      memset(dst, p->regs.al, len);
+   } else {
+      for (int i = 0; i < len; i += 2) {
+         dst[i] = p->regs.al;
+         dst[i + 1] = p->regs.ah;
+      }
+   }
+
+   update_di(p, (vxt_word)len);
+   p->regs.cx -= n;
+   p->cycles += n * cycle;
+   p->bus_transfers += len;
+   return n;
+}
+
+static int bulk_lods(CONSTSP(cpu) p, int size, int cycle) {
+   vxt_byte *src;
+   const int n = bulk_span(p, p->seg, p->regs.si, size, p->regs.cx, false, &src);
+   if (!n)
+      return 0;
+
+   const int len = n * size;
+   const vxt_byte *last = (p->regs.flags & VXT_DIRECTION) ? (src - (len - size)) : (src + (len - size));
+   if (size == 1)
+      p->regs.al = *last;
+   else
+      p->regs.ax = WORD(last[1], *last);
+
+   update_si(p, (vxt_word)len);
+   p->regs.cx -= n;
+   p->cycles += n * cycle;
+   p->bus_transfers += len;
+   return n;
+}
+
+static vxt_word element(const vxt_byte *ptr, int size) {
+   return (size == 1) ? *ptr : WORD(ptr[1], *ptr);
+}
+
+// Index of the first element where the comparison of a against b, or against v if b is NULL,
+// gives the result in 'equal'. Returns n if there is no such element.
+static int scan_elements(const vxt_byte *a, const vxt_byte *b, vxt_word v, int size, int n, bool equal, bool down) {
+   int i = 0;
+   if (down) {
+      for (; i < n; i++) {
+         const int offset = -i * size;
+         if ((element(a + offset, size) == (b ? element(b + offset, size) : v)) == equal)
+            return i;
+      }
+      return n;
+   }
+
+   #if !defined(VXT_NO_SIMD) && defined(__AVX2__)
+      {
+         const __m256i pattern = (size == 1) ? _mm256_set1_epi8((char)v) : _mm256_set1_epi16((short)v);
+         for (; (i + 32) <= (n * size); i += 32) {
+            const __m256i x = _mm256_loadu_si256((const __m256i*)&a[i]);
+            const __m256i y = b ? _mm256_loadu_si256((const __m256i*)&b[i]) : pattern;
+            unsigned int mask = (unsigned int)_mm256_movemask_epi8((size == 1) ? _mm256_cmpeq_epi8(x, y) : _mm256_cmpeq_epi16(x, y));
+            if (!equal)
+               mask = ~mask;
+            if (mask)
+               return (i + __builtin_ctz(mask)) / size;
+         }
+      }
+   #endif
+
+   #if !defined(VXT_NO_SIMD) && defined(__SSE2__)
+      {
+         const __m128i pattern = (size == 1) ? _mm_set1_epi8((char)v) : _mm_set1_epi16((short)v);
+         for (; (i + 16) <= (n * size); i += 16) {
+            const __m128i x = _mm_loadu_si128((const __m128i*)&a[i]);
+            const __m128i y = b ? _mm_loadu_si128((const __m128i*)&b[i]) : pattern;
+            unsigned int mask = (unsigned int)_mm_movemask_epi8((size == 1) ? _mm_cmpeq_epi8(x, y) : _mm_cmpeq_epi16(x, y));
+            if (!equal)
+               mask = ~mask & 0xFFFF;
+            if (mask)
+               return (i + __builtin_ctz(mask)) / size;
+         }
+      }
+   #endif
+
+   for (i /= size; i < n; i++) {
+      const int offset = i * size;
+      if ((element(a + offset, size) == (b ? element(b + offset, size) : v)) == equal)
+         return i;
+   }
+   return n;
+}
+
+// Runs until the element that ends the repeat, or the end of the span.
+// Flags are only calculated for the last element compared.
+static int bulk_scas(CONSTSP(cpu) p, int size, int cycle) {
+   vxt_byte *src;
+   const int n = bulk_span(p, p->regs.es, p->regs.di, size, p->regs.cx, false, &src);
+   if (!n)
+      return 0;
+
+   const bool down = (p->regs.flags & VXT_DIRECTION) != 0;
+   const vxt_word v = (size == 1) ? p->regs.al : p->regs.ax;
+   const int i = scan_elements(src, NULL, v, size, n, p->repeat == 0xF2, down);
+   const int count = (i < n) ? i + 1 : n;
+   const vxt_word last = element(src + (down ? -(count - 1) : (count - 1)) * size, size);
+
+   if (size == 1)
+      flag_sub_sbb8(&p->regs, (vxt_byte)v, (vxt_byte)last, 0);
+   else
+      flag_sub_sbb16(&p->regs, v, last, 0);
+
+   update_di(p, (vxt_word)(count * size));
+   p->regs.cx -= count;
+   p->cycles += (i < n) ? (i * cycle + ((p->repeat == 0xF2) ? 5 : 6)) : (n * cycle);
+   p->bus_transfers += count * size;
+   return count;
+}
+
+static int bulk_cmps(CONSTSP(cpu) p, int size, int cycle) {
+   vxt_byte *src, *dst;
+   int n = bulk_span(p, p->seg, p->regs.si, size, p->regs.cx, false, &src);
+   if (n)
+      n = bulk_span(p, p->regs.es, p->regs.di, size, n, false, &dst);
+   if (!n)
+      return 0;
+
+   const bool down = (p->regs.flags & VXT_DIRECTION) != 0;
+   const int i = scan_elements(src, dst, 0, size, n, p->repeat == 0xF2, down);
+   const int count = (i < n) ? i + 1 : n;
+   const int offset = (down ? -(count - 1) : (count - 1)) * size;
+   const vxt_word a = element(src + offset, size);
+   const vxt_word b = element(dst + offset, size);
+
+   if (size == 1)
+      flag_sub_sbb8(&p->regs, (vxt_byte)a, (vxt_byte)b, 0);
+   else
+      flag_sub_sbb16(&p->regs, a, b, 0);
+
+   update_di_si(p, (vxt_word)(count * size));
+   p->regs.cx -= count;
+   p->cycles += (i < n) ? (i * cycle + ((p->repeat == 0xF2) ? 5 : 6)) : (n * cycle);
+   p->bus_transfers += count * size * 2;
+   return count;
+}
+
 #define REPEAT(name, cycle, op)                    \
    static void name (CONSTSP(cpu) p) {             \
       if (!p->repeat) {                            \
@@ -35,6 +255,22 @@
       }                                            \
    }                                               \
 
+// Runs of plain RAM or ROM are handled in bulk. Everything else, and validated execution, goes through the bus one element at the time.
+#define BULK_REPEAT(name, cycle, size, bulk, op)                        \
+   static void name (CONSTSP(cpu) p) {                                  \
+      if (!p->repeat) {                                                 \
+         op                                                             \
+         return;                                                        \
+      }                                                                 \
+      while (p->regs.cx) {                                              \
+         if (!CPU_INSTRUMENTED(p) && bulk(p, size, cycle))              \
+            continue;                                                   \
+         op                                                             \
+         p->regs.cx--;                                                  \
+         p->cycles += cycle;                                            \
+      }                                                                 \
+   }                                                                    \
+
 REPEAT(insb_6C, 4, {
    cpu_segment_write_byte(p, p->regs.es, p->regs.di, system_in(p->s, p->regs.dx));
    p->regs.di += (p->regs.flags & VXT_DIRECTION) ? -1 : 1;
@@ -53,44 +289,50 @@ REPEAT(outsw_6F, 4, {
    system_out(p->s, p->regs.dx + 1, data >> 8);
    p->regs.si += (p->regs.flags & VXT_DIRECTION) ? -2 : 2;
 })
-REPEAT(movsb_A4, 17, {
+BULK_REPEAT(movsb_A4, 17, 1, bulk_movs, {
    cpu_segment_write_byte(p, p->regs.es, p->regs.di, cpu_segment_read_byte(p, p->seg, p->regs.si));
    update_di_si(p, 1);
 })
-REPEAT(movsw_A5, 25, {
+BULK_REPEAT(movsw_A5, 25, 2, bulk_movs, {
    cpu_segment_write_word(p, p->regs.es, p->regs.di, cpu_segment_read_word(p, p->seg, p->regs.si));
    update_di_si(p, 2);
 })
-REPEAT(stosb_AA, 10, {
+BULK_REPEAT(stosb_AA, 10, 1, bulk_stos, {
    cpu_segment_write_byte(p, p->regs.es, p->regs.di, p->regs.al);
    update_di(p, 1);
 })
-REPEAT(stosw_AB, 14, {
+BULK_REPEAT(stosw_AB, 14, 2, bulk_stos, {
    cpu_segment_write_word(p, p->regs.es, p->regs.di, p->regs.ax);
    update_di(p, 2);
 })
-REPEAT(lodsb_AC, 16, {
+BULK_REPEAT(lodsb_AC, 16, 1, bulk_lods, {
    p->regs.al = cpu_segment_read_byte(p, p->seg, p->regs.si);
    update_si(p, 1);
 })
-REPEAT(lodsw_AD, 16, {
+BULK_REPEAT(lodsw_AD, 16, 2, bulk_lods, {
    p->regs.ax = cpu_segment_read_word(p, p->seg, p->regs.si);
    update_si(p, 2);
 })
+#undef BULK_REPEAT
 #undef REPEAT
 
-#define REPEAT(name, cycle, op)                                                  \
+#define REPEAT_END(p) (((p)->repeat == 0xF3) ? !((p)->regs.flags & VXT_ZERO) : ((p)->regs.flags & VXT_ZERO))
+
+#define REPEAT(name, cycle, size, bulk, op)                                      \
    static void name (CONSTSP(cpu) p) {                                           \
       if (!p->repeat) {                                                          \
          op                                                                      \
          return;                                                                 \
       }                                                                          \
       while (p->regs.cx) {                                                       \
+         if (!CPU_INSTRUMENTED(p) && bulk(p, size, cycle)) {                     \
+            if (REPEAT_END(p))                                                   \
+               break;                                                            \
+            continue;                                                            \
+         }                                                                       \
          op                                                                      \
          p->regs.cx--;                                                           \
-         if (((p->repeat == 0xF3) && !(p->regs.flags & VXT_ZERO)) ||             \
-            ((p->repeat == 0xF2) && (p->regs.flags & VXT_ZERO)))                 \
-         {                                                                       \
+         if (REPEAT_END(p)) {                                                    \
             p->cycles += (p->repeat == 0xF2) ? 5 : 6; /* Is this correct? */     \
             break;                                                               \
          }                                                                       \
@@ -98,28 +340,29 @@ REPEAT(lodsw_AD, 16, {
       }                                                                          \
    }                                                                             \
 
-REPEAT(cmpsb_A6, 30, {
+REPEAT(cmpsb_A6, 30, 1, bulk_cmps, {
    vxt_byte a = cpu_segment_read_byte(p, p->seg, p->regs.si);
    vxt_byte b = cpu_segment_read_byte(p, p->regs.es, p->regs.di);
    update_di_si(p, 1);
    flag_sub_sbb8(&p->regs, a, b, 0);
 })
-REPEAT(cmpsw_A7, 30, {
+REPEAT(cmpsw_A7, 30, 2, bulk_cmps, {
    vxt_word a = cpu_segment_read_word(p, p->seg, p->regs.si);
    vxt_word b = cpu_segment_read_word(p, p->regs.es, p->regs.di);
    update_di_si(p, 2);
    flag_sub_sbb16(&p->regs, a, b, 0);
 })
-REPEAT(scasb_AE, 15, {
+REPEAT(scasb_AE, 15, 1, bulk_scas, {
    vxt_byte v = cpu_segment_read_byte(p, p->regs.es, p->regs.di);
    update_di(p, 1);
    flag_sub_sbb8(&p->regs, p->regs.al, v, 0);
 })
-REPEAT(scasw_AF, 19, {
+REPEAT(scasw_AF, 19, 2, bulk_scas, {
    vxt_word v = cpu_segment_read_word(p, p->regs.es, p->regs.di);
    update_di(p, 2);
    flag_sub_sbb16(&p->regs, p->regs.ax, v, 0);
 })
+#undef REPEAT_END
 #undef REPEAT
 
 #define LOOP(name, cond, taken, ntaken)                  \
@@ -31,168 +31,105 @@
 #define OVERFLOW_LEFT(sig) SET_FLAG_IF(p->regs.flags, VXT_OVERFLOW, (p->regs.flags & VXT_CARRY) ^ (vxt_word)(sig))
 #define OVERFLOW_RIGHT(sig2) SET_FLAG_IF(p->regs.flags, VXT_OVERFLOW, ((sig2) >> 1) ^ ((sig2) & 1))
 
-static vxt_byte bitshift_8(CONSTSP(cpu) p, vxt_byte v, vxt_byte c) {
+// The 8088 does not mask the count, so all of the 255 iterations are done in closed form. Rotates
+// through carry are rotates of a 9 or 17 bit value, and repeat modulo that. Shifts by more than
+// the operand size leave zero, or the sign for SAR.
+static vxt_word bitshift(CONSTSP(cpu) p, vxt_word v, vxt_byte c, int bits) {
 	if (c == 0)
 		return v;
 
-	vxt_byte o = v;
-	vxt_byte s;
-
-	for (int i = 0; i < c; i++) {
-		switch (p->mode.reg) {
-         case 0: // ROL r/m8
-            s = v & 0x80;
-            SET_FLAG_IF(p->regs.flags, VXT_CARRY, s);
-            v = (v << 1) | (s >> 7);
-            break;
-         case 1: // ROR r/m8
-            s = v & 1;
-            SET_FLAG_IF(p->regs.flags, VXT_CARRY, s);
-            v = (v >> 1) | (s << 7);
-            break;
-         case 2: // RCL r/m8
-            s = v & 0x80;
-            v <<= 1;
-            if (FLAGS(p->regs.flags, VXT_CARRY))
-               v |= 1;
-            SET_FLAG_IF(p->regs.flags, VXT_CARRY, s);
-            break;
-         case 3: // RCR r/m8
-            s = v & 1;
-            v >>= 1;
-            if (FLAGS(p->regs.flags, VXT_CARRY))
-               v |= 0x80;
-            SET_FLAG_IF(p->regs.flags, VXT_CARRY, s);
-            break;
-         case 4: // SHL r/m8
-         case 6:
-            SET_FLAG_IF(p->regs.flags, VXT_CARRY, v & 0x80);
-            v <<= 1;
-            break;
-         case 5: // SHR r/m8
-            SET_FLAG_IF(p->regs.flags, VXT_CARRY, v & 1);
-            v >>= 1;
-            break;
-         case 7: // SAR r/m8
-            s = v & 0x80;
-            SET_FLAG_IF(p->regs.flags, VXT_CARRY, v & 1);
-            v = (v >> 1) | s;
-            break;
-         default:
-            return v; // Invalid opcode
-		}
-	}
+	const vxt_dword mask = (1u << bits) - 1;
+	const vxt_dword o = v;
+	const int sign = bits - 1;
+	vxt_dword r, cf;
 
 	switch (p->mode.reg) {
-      case 0:
-         OVERFLOW_LEFT(v >> 7);
+      case 0: // ROL r/m
+      {
+         const int n = c % bits;
+         r = ((o << n) | (o >> (bits - n))) & mask;
+         cf = r & 1;
          break;
-      case 1:
-         OVERFLOW_RIGHT(v >> 6);
+      }
+      case 1: // ROR r/m
+      {
+         const int n = c % bits;
+         r = ((o >> n) | (o << (bits - n))) & mask;
+         cf = r >> sign;
          break;
-      case 2:
-         OVERFLOW_LEFT(v >> 7);
+      }
+      case 2: // RCL r/m
+      {
+         const int n = c % (bits + 1);
+         const vxt_dword x = o | ((vxt_dword)(p->regs.flags & VXT_CARRY) << bits);
+         const vxt_dword y = ((x << n) | (x >> (bits + 1 - n))) & ((mask << 1) | 1);
+         r = y & mask;
+         cf = y >> bits;
          break;
-      case 3:
-         OVERFLOW_RIGHT(v >> 6);
+      }
+      case 3: // RCR r/m
+      {
+         const int n = c % (bits + 1);
+         const vxt_dword x = o | ((vxt_dword)(p->regs.flags & VXT_CARRY) << bits);
+         const vxt_dword y = ((x >> n) | (x << (bits + 1 - n))) & ((mask << 1) | 1);
+         r = y & mask;
+         cf = y >> bits;
          break;
-      case 4:
+      }
+      case 4: // SHL r/m
       case 6:
-         SET_FLAG_IF(p->regs.flags, VXT_OVERFLOW, (v >> 7) != (vxt_byte)(p->regs.flags & VXT_CARRY));
-         flag_szp8(&p->regs, v);
+         r = (c > bits) ? 0 : ((o << c) & mask);
+         cf = (c > bits) ? 0 : ((o >> (bits - c)) & 1);
          break;
-      case 5:
-         SET_FLAG_IF(p->regs.flags, VXT_OVERFLOW, (c == 1) && (o & 0x80));
-         flag_szp8(&p->regs, v);
+      case 5: // SHR r/m
+         r = (c > bits) ? 0 : (o >> c);
+         cf = (c > bits) ? 0 : ((o >> (c - 1)) & 1);
          break;
-      case 7:
-         p->regs.flags &= ~VXT_OVERFLOW;
-         flag_szp8(&p->regs, v);
+      default: // SAR r/m
+      {
+         const vxt_dword fill = (o >> sign) ? mask : 0;
+         r = (c >= bits) ? fill : (((o >> c) | (fill << (bits - c))) & mask);
+         cf = (c >= bits) ? (fill & 1) : ((o >> (c - 1)) & 1);
          break;
+      }
 	}
-	return v;
-}
-
-static vxt_word bitshift_16(CONSTSP(cpu) p, vxt_word v, vxt_byte c) {
-	if (c == 0)
-		return v;
 
-	vxt_word o = v;
-	vxt_word s;
-
-	for (int i = 0; i < c; i++) {
-		switch (p->mode.reg) {
-         case 0: // ROL r/m8
-            s = v & 0x8000;
-            SET_FLAG_IF(p->regs.flags, VXT_CARRY, s);
-            v = (v << 1) | (s >> 15);
-            break;
-         case 1: // ROR r/m8
-            s = v & 1;
-            SET_FLAG_IF(p->regs.flags, VXT_CARRY, s);
-            v = (v >> 1) | (s << 15);
-            break;
-         case 2: // RCL r/m8
-            s = v & 0x8000;
-            v <<= 1;
-            if (FLAGS(p->regs.flags, VXT_CARRY))
-               v |= 1;
-            SET_FLAG_IF(p->regs.flags, VXT_CARRY, s);
-            break;
-         case 3: // RCR r/m8
-            s = v & 1;
-            v >>= 1;
-            if (FLAGS(p->regs.flags, VXT_CARRY))
-               v |= 0x8000;
-            SET_FLAG_IF(p->regs.flags, VXT_CARRY, s);
-            break;
-         case 4: // SHL r/m8
-         case 6:
-            SET_FLAG_IF(p->regs.flags, VXT_CARRY, v & 0x8000);
-            v <<= 1;
-            break;
-         case 5: // SHR r/m8
-            SET_FLAG_IF(p->regs.flags, VXT_CARRY, v & 1);
-            v >>= 1;
-            break;
-         case 7: // SAR r/m8
-            s = v & 0x8000;
-            SET_FLAG_IF(p->regs.flags, VXT_CARRY, v & 1);
-            v = (v >> 1) | s;
-            break;
-         default:
-            return v; // Invalid opcode
-		}
-	}
+	SET_FLAG_IF(p->regs.flags, VXT_CARRY, cf);
 
 	switch (p->mode.reg) {
       case 0:
-         OVERFLOW_LEFT(v >> 15);
-         break;
-      case 1:
-         OVERFLOW_RIGHT(v >> 14);
-         break;
       case 2:
-         OVERFLOW_LEFT(v >> 15);
-         break;
+         OVERFLOW_LEFT(r >> sign);
+         return (vxt_word)r;
+      case 1:
       case 3:
-         OVERFLOW_RIGHT(v >> 14);
-         break;
+         OVERFLOW_RIGHT(r >> (sign - 1));
+         return (vxt_word)r;
       case 4:
       case 6:
-         SET_FLAG_IF(p->regs.flags, VXT_OVERFLOW, (v >> 15) != (vxt_byte)(p->regs.flags & VXT_CARRY));
-         flag_szp16(&p->regs, v);
+         SET_FLAG_IF(p->regs.flags, VXT_OVERFLOW, (r >> sign) != cf);
          break;
       case 5:
-         SET_FLAG_IF(p->regs.flags, VXT_OVERFLOW, (c == 1) && (o & 0x8000));
-         flag_szp16(&p->regs, v);
+         SET_FLAG_IF(p->regs.flags, VXT_OVERFLOW, (c == 1) && (o >> sign));
          break;
-      case 7:
+      default:
          p->regs.flags &= ~VXT_OVERFLOW;
-         flag_szp16(&p->regs, v);
          break;
 	}
-	return v;
+
+	if (bits == 8)
+		flag_szp8(&p->regs, (vxt_byte)r);
+	else
+		flag_szp16(&p->regs, (vxt_word)r);
+	return (vxt_word)r;
+}
+
+static vxt_byte bitshift_8(CONSTSP(cpu) p, vxt_byte v, vxt_byte c) {
+	return (vxt_byte)bitshift(p, v, c, 8);
+}
+
+static vxt_word bitshift_16(CONSTSP(cpu) p, vxt_word v, vxt_byte c) {
+	return bitshift(p, v, c, 16);
 }
 
 #undef OVERFLOW_LEFT
@@ -42,11 +42,15 @@
    VXT_API int (*_vxt_logger)(const char*, ...) = &no_print;
 #endif
 
+static INT64 timer_deadline(CONSTP(vxt_system) s, const struct timer *t) {
+    return (INT64)(t->interval * (double)s->frequency);
+}
+
 static vxt_error update_timers(CONSTP(vxt_system) s, int ticks) {
     for (int i = 0; i < s->num_timers; i++) {
         struct timer *t = &s->timers[i];
         t->ticks += ticks;
-        if (UNLIKELY(t->ticks >= (INT64)(t->interval * (double)s->frequency))) {
+        if (UNLIKELY(t->ticks >= timer_deadline(s, t))) {
             vxt_error err = t->dev->timer(vxt_peripheral_device(t->dev), t->id, (int)t->ticks);
             if (err != VXT_NO_ERROR)
                 return err;
@@ -56,6 +60,79 @@ static vxt_error update_timers(CONSTP(vxt_system) s, int ticks) {
     return VXT_NO_ERROR;
 }
 
+// Cycles until the first timer has an effect, if 'ticks' more cycles have already passed.
+// Never more than 'max', so a step does not run past its budget.
+static int cycles_to_timer(CONSTP(vxt_system) s, int ticks, int max) {
+    INT64 next = max;
+    for (int i = 0; i < s->num_timers; i++) {
+        const struct timer *t = &s->timers[i];
+        INT64 deadline = timer_deadline(s, t);
+
+        // Timers without an interval run every step. Only the device knows when they matter.
+        if (!deadline) {
+            int (*next_event)(void*,vxt_timer_id) = t->dev->next_event;
+            if (!next_event)
+                return 0;
+            if ((deadline = next_event(vxt_peripheral_device(t->dev), t->id)) < 0)
+                continue;
+        }
+
+        const INT64 left = deadline - t->ticks - ticks;
+        if (left < next)
+            next = left;
+    }
+    return (next > 0) ? (int)next : 0;
+}
+
+static bool same_registers(const struct vxt_registers *a, const struct vxt_registers *b) {
+    return (a->ax == b->ax) && (a->bx == b->bx) && (a->cx == b->cx) && (a->dx == b->dx)
+        && (a->cs == b->cs) && (a->ss == b->ss) && (a->ds == b->ds) && (a->es == b->es)
+        && (a->sp == b->sp) && (a->bp == b->bp) && (a->si == b->si) && (a->di == b->di)
+        && (a->ip == b->ip) && (a->flags == b->flags);
+}
+
+// Short backward loops that repeat with the same registers and the same memory writes, and
+// no other side effects, only depend on device state. That changes in timers or between steps,
+// so whole iterations can be skipped up to the next timer event. The loop may call out to
+// other code, like INT 16h, so other backward jumps are ignored while the head keeps repeating.
+static int idle_loop(CONSTP(vxt_system) s, int ticks, int max) {
+    CONSTSP(cpu) p = &s->cpu;
+    struct idle *d = &s->idle;
+    d->cycles += ticks;
+
+    if ((p->regs.ip >= p->inst_start) || ((p->inst_start - p->regs.ip) > IDLE_MAX_LOOP))
+        return 0;
+
+    const vxt_pointer head = VXT_POINTER(p->regs.cs, p->regs.ip);
+    if ((head != d->head) && (++d->misses <= IDLE_MAX_MISSES))
+        return 0;
+
+    cpu_update_flags(p);
+    const bool same = (head == d->head) && !p->side_effect && (p->write_hash == d->hash) && (d->cycles == d->loop_cycles)
+        && (p->inst_queue_count == d->queue_count) && (p->biu_cycles == d->biu_cycles) && same_registers(&p->regs, &d->regs);
+
+    d->matches = same ? (d->matches + 1) : 0;
+    d->misses = 0;
+    d->head = head;
+    d->hash = p->write_hash;
+    d->loop_cycles = d->cycles;
+    d->queue_count = p->inst_queue_count;
+    d->biu_cycles = p->biu_cycles;
+    d->regs = p->regs;
+
+    d->cycles = 0;
+    p->write_hash = 0;
+    p->side_effect = false;
+
+    if (d->matches < IDLE_MATCHES)
+        return 0;
+
+    const int n = cycles_to_timer(s, ticks, max) / d->loop_cycles;
+    if (n)
+        d->stats.loops++;
+    return n * d->loop_cycles;
+}
+
 VXT_API const char *vxt_error_str(vxt_error err) {
     #define ERROR_TEXT(id, name, text) case id: return text;
     switch (err) {
@@ -75,12 +152,34 @@ VXT_API void vxt_set_logger(int (*f)(const char*, ...)) {
     _vxt_logger = f;
 }
 
+// Signatures are verified here, once. Devices may replace their callbacks in install so this runs again after it.
+static void build_dispatch(CONSTP(vxt_system) s) {
+    for (int i = 0; i < s->num_devices; i++) {
+        CONSTSP(vxt_peripheral) d = s->devices[i];
+        s->io[i] = (struct io_dispatch){
+            vxt_peripheral_device(d), d->io.in, d->io.out, d->io.read, d->io.write, d->io16.read16, d->io16.write16
+        };
+    }
+}
+
 VXT_API vxt_system *vxt_system_create(vxt_allocator *alloc, int frequency, struct vxt_peripheral * const devs[]) {
     vxt_system *s = (vxt_system*)alloc(NULL, sizeof(struct system));
+    if (!s) return NULL;
     vxt_memclear(s, sizeof(struct system));
+
+    // Cold tables live in their own allocation so they do not share cache lines with the step loop state.
+    s->tables = (struct system_tables*)alloc(NULL, sizeof(struct system_tables));
+    if (!s->tables) {
+        alloc(s, 0);
+        return NULL;
+    }
+    vxt_memclear(s->tables, sizeof(struct system_tables));
+
     s->alloc = alloc;
     s->frequency = frequency;
+    s->a20_mask = A20_MASK(false);
 	s->cpu.s = s;
+	vxt_system_set_cpu_model(s, VXT_CPU_80286);
 
     int i = 1;
     for (; devs && devs[i-1]; i++) {
@@ -99,9 +198,17 @@ VXT_API vxt_system *vxt_system_create(vxt_allocator *alloc, int frequency, struc
     for (i = 0; i < MAX_TIMERS; i++)
         s->timers[i].id = VXT_INVALID_TIMER_ID;
 
+    // The HMA is plain memory so it is accessed like any other direct mapped page.
+    for (i = 0; i < (EXT_MEM_SIZE >> MEM_PAGE_SHIFT); i++) {
+        struct mem_page *mp = &s->mem_pages[(0x100000 >> MEM_PAGE_SHIFT) + i];
+        mp->read = mp->write = &s->tables->ext_mem[i << MEM_PAGE_SHIFT];
+        mp->writable = true;
+    }
+
     // Always init dummy device 0. Depends on memset!
     s->devices[0] = (struct vxt_peripheral*)&s->dummy;
     init_dummy_device(s);
+    build_dispatch(s);
     return s;
 }
 
@@ -141,16 +248,23 @@ VXT_API vxt_error _vxt_system_initialize(CONSTP(vxt_system) s, unsigned reg_size
     vxt_system_install_monitor(s, NULL, "IP", &s->cpu.regs.ip, VXT_MONITOR_SIZE_WORD|VXT_MONITOR_FORMAT_HEX);
     vxt_system_install_monitor(s, NULL, "Flags", &s->cpu.regs.ip, VXT_MONITOR_SIZE_WORD|VXT_MONITOR_FORMAT_BINARY);
 
+    vxt_system_install_monitor(s, NULL, "Idle Loops", &s->idle.stats.loops, VXT_MONITOR_SIZE_QWORD|VXT_MONITOR_FORMAT_DECIMAL);
+    vxt_system_install_monitor(s, NULL, "Idle Cycles", &s->idle.stats.cycles, VXT_MONITOR_SIZE_QWORD|VXT_MONITOR_FORMAT_DECIMAL);
+
+    long long (*clock)(void) = s->tables->startup_clock;
     for (int i = 0; i < s->num_devices; i++) {
         CONSTSP(vxt_peripheral) d = s->devices[i];
         if (d->install) {
+            const long long start = clock ? clock() : 0;
             vxt_error err = d->install(vxt_peripheral_device(d), s);
+            if (clock) s->tables->startup_timing[i].install = clock() - start;
             if (err) return err;
         }
         if (vxt_peripheral_class(d) == VXT_PCLASS_PIC)
             s->cpu.pic = d;
     }
 
+    build_dispatch(s);
     if (s->cpu.validator)
         s->cpu.validator->initialize(s, s->cpu.validator->userdata);
     return VXT_NO_ERROR;
@@ -163,6 +277,221 @@ TEST(system_initialize,
     vxt_system_destroy(sp);
 )
 
+// The HMA is only visible with A20 enabled. Otherwise accesses wrap around to the start of memory.
+TEST(a20_gate,
+    vxt_byte *mem;
+    CONSTP(vxt_system) s = test_machine_create(&mem, NULL, NULL, 0);
+    TENSURE(s);
+
+    vxt_system_write_word(s, VXT_POINTER(0xFFFF, 0x20), 0x1234);
+    TENSURE(vxt_system_read_word(s, 0x10) == 0x1234);
+
+    vxt_system_set_a20(s, true);
+    TENSURE(vxt_system_read_word(s, VXT_POINTER(0xFFFF, 0x20)) == 0);
+    vxt_system_write_word(s, VXT_POINTER(0xFFFF, 0x20), 0x5678);
+    vxt_system_write_byte(s, 0x10FFFF, 0xAB);
+    TENSURE(vxt_system_read_word(s, 0x100010) == 0x5678);
+    TENSURE(vxt_system_read_byte(s, 0x10FFFF) == 0xAB);
+    TENSURE(vxt_system_read_word(s, 0x10) == 0x1234);
+    TENSURE(vxt_system_read_byte(s, 0x110000) == 0xFF);
+
+    vxt_system_set_a20(s, false);
+    TENSURE(vxt_system_read_word(s, VXT_POINTER(0xFFFF, 0x20)) == 0x1234);
+
+    test_machine_destroy(s, mem);
+)
+
+// Block transfers must give the same result as byte accesses, across pages, devices and the A20 wrap.
+TEST(block_transfer,
+    vxt_byte *mem;
+    vxt_byte *buf = (vxt_byte*)TALLOC(NULL, 0x1000);
+    CONSTP(vxt_system) s = test_machine_create(&mem, NULL, NULL, 0);
+    TENSURE(buf && s);
+
+    for (int i = 0; i < 0x10000; i++)
+        mem[i] = (vxt_byte)(i * 7);
+
+    // Crosses from RAM into the dummy device.
+    vxt_system_read_block(s, 0xF800, buf, 0x1000);
+    for (int i = 0; i < 0x1000; i++)
+        TENSURE(buf[i] == vxt_system_read_byte(s, 0xF800 + i));
+
+    for (int i = 0; i < 0x20; i++)
+        buf[i] = (vxt_byte)i;
+
+    vxt_system_write_block(s, 0x10FFF0, buf, 0x10);
+    vxt_system_write_block(s, 0xFFFF8, &buf[0x10], 0x10);
+    TENSURE(mem[0xFFF0] == 0 && mem[0xFFFF] == 0xF && mem[0] == 0x18 && mem[0x7] == 0x1F && mem[0x8] == 0x38);
+
+    vxt_system_set_a20(s, true);
+    vxt_system_write_block(s, 0x10FFF0, buf, 0x20);
+    vxt_system_read_block(s, 0x10FFF0, &buf[0x100], 0x20);
+    TENSURE(buf[0x100] == 0 && buf[0x10F] == 0xF && buf[0x110] == 0xFF && buf[0x11F] == 0xFF);
+
+    test_machine_destroy(s, mem);
+    TFREE(buf);
+)
+
+#ifdef TESTING
+    #include <time.h>
+
+    static const vxt_byte test_profile_code[] = {
+        0xB9, 0x64, 0x00, // MOV CX,100
+        0x40,             // INC AX
+        0xE2, 0xFD,       // LOOP -3
+        0xF4              // HLT
+    };
+#endif
+
+// Checks the profiler counts for a small loop, and the shadow call stack.
+TEST(profiler,
+    vxt_byte *mem;
+    CONSTP(vxt_system) s = test_machine_create(&mem, NULL, test_profile_code, sizeof(test_profile_code));
+    TENSURE(s);
+    vxt_system_set_decode_cache(s, true);
+
+    vxt_system_set_profiler(s, true);
+    while (!s->cpu.halt)
+        vxt_system_step(s, 1);
+    vxt_system_set_profiler(s, false);
+
+    struct vxt_profile_entry top[4];
+    TENSURE(vxt_system_profile_addresses(s, top, 4) == 4);
+    TENSURE(top[0].addr == 0x104 && top[0].count == 100 && top[0].opcode == 0xE2);
+    TENSURE(top[1].addr == 0x103 && top[1].count == 100);
+    TENSURE(top[0].cycles >= top[1].cycles && top[2].cycles >= top[3].cycles);
+
+    TENSURE(vxt_system_profile_opcodes(s, top, 1) == 1);
+    TENSURE(top[0].opcode == 0xE2 && top[0].count == 100 && top[0].name);
+
+    // CALL 0x130 followed by HLT in the subroutine.
+    mem[0x120] = 0xE8;
+    mem[0x121] = 0x0D;
+    mem[0x130] = 0xF4;
+
+    vxt_pointer frames[4];
+    vxt_system_clear_profiler(s);
+    vxt_system_set_profiler(s, true);
+    s->cpu.halt = false;
+    s->cpu.regs.ip = 0x120;
+    s->cpu.regs.sp = 0x1000;
+    while (!s->cpu.halt)
+        vxt_system_step(s, 1);
+    TENSURE(vxt_system_profile_stack(s, frames, 4) == 1);
+    TENSURE(frames[0] == 0x130);
+
+    test_machine_destroy(s, mem);
+)
+
+// Runs the loop forever and compares the run time with and without the profiler.
+BENCH(profiler,
+    vxt_byte *mem;
+    CONSTP(vxt_system) s = test_machine_create(&mem, NULL, test_profile_code, sizeof(test_profile_code));
+    TENSURE(s);
+    vxt_system_set_decode_cache(s, true);
+    mem[0x106] = 0xEB; // JMP -8
+    mem[0x107] = 0xF8;
+
+    double t[2];
+    for (int i = 0; i < 2; i++) {
+        vxt_system_clear_profiler(s);
+        vxt_system_set_profiler(s, i != 0);
+        vxt_system_reset(s);
+        s->cpu.regs.cs = 0;
+        s->cpu.regs.ip = 0x100;
+
+        const clock_t start = clock();
+        for (int j = 0; j < 1000; j++)
+            vxt_system_step(s, 10000);
+        t[i] = (double)(clock() - start);
+    }
+    TLOG("%s: %.1f%% overhead", T.name, (t[1] / t[0] - 1.0) * 100.0);
+
+    test_machine_destroy(s, mem);
+)
+
+#ifdef TESTING
+    static const vxt_byte test_idle_code[] = {
+        0x80, 0x3E, 0x00, 0x02, 0x00, // CMP BYTE [0x200],0
+        0x74, 0xF9,                   // JZ -7
+        0xF4                          // HLT
+    };
+#endif
+
+// Polls a memory flag in a tight loop and checks that the loop is fast-forwarded, and that it still exits when the flag is set.
+TEST(idle_loop,
+    vxt_byte *mem;
+    CONSTP(vxt_system) s = test_machine_create(&mem, NULL, test_idle_code, sizeof(test_idle_code));
+    TENSURE(s);
+
+    for (int i = 0; i < 2; i++) {
+        vxt_system_reset(s);
+        vxt_system_set_idle_detection(s, i != 0);
+        s->cpu.regs.cs = 0;
+        s->cpu.regs.ip = 0x100;
+
+        struct vxt_step res = vxt_system_step(s, 100000);
+        TENSURE(res.cycles >= 100000);
+        TENSURE(res.idle == (i != 0));
+        TENSURE(s->cpu.regs.ip >= 0x100 && s->cpu.regs.ip < 0x107);
+    }
+
+    const struct vxt_idle_stats stats = vxt_system_idle_stats(s);
+    TENSURE(stats.loops > 0 && stats.cycles > 90000);
+
+    mem[0x200] = 1;
+    vxt_system_step(s, 1000);
+    TENSURE(s->cpu.halt && (s->cpu.regs.ip == 0x108));
+
+    test_machine_destroy(s, mem);
+)
+
+#ifdef TESTING
+    static const vxt_byte test_idle_call_code[] = {
+        0xBB, 0x01, 0x00, // MOV BX,1
+        0xE8, 0x0A, 0x00, // CALL 0x110
+        0x3C, 0x00,       // CMP AL,0
+        0x74, 0xF9,       // JZ -7
+        0xF4              // HLT
+    };
+#endif
+
+// A keyboard polling loop that calls out to a slow subroutine, like INT 16h, is still fast-forwarded
+// when it is stepped 1 ms at a time like the SDL2 frontend does.
+TEST(idle_frontend_step,
+    vxt_byte *mem;
+    CONSTP(vxt_system) s = test_machine_create(&mem, NULL, test_idle_call_code, sizeof(test_idle_call_code));
+    TENSURE(s);
+
+    // 12 x (XOR DX,DX / DIV BX) followed by MOV AL,[0x200] and RET.
+    for (int i = 0; i < 12; i++) {
+        mem[0x110 + i * 4] = 0x31; mem[0x111 + i * 4] = 0xD2;
+        mem[0x112 + i * 4] = 0xF7; mem[0x113 + i * 4] = 0xF3;
+    }
+    mem[0x140] = 0xA0; mem[0x141] = 0x00; mem[0x142] = 0x02;
+    mem[0x143] = 0xC3;
+
+    const int budget = VXT_DEFAULT_FREQUENCY / 1000;
+    vxt_system_set_idle_detection(s, true);
+
+    int cycles = 0;
+    for (int i = 0; i < 100; i++) {
+        const struct vxt_step res = vxt_system_step(s, budget);
+        TENSURE(res.cycles < budget + 200);
+        cycles += res.cycles;
+    }
+
+    const struct vxt_idle_stats stats = vxt_system_idle_stats(s);
+    TLOG("%s: %d cycles per step, %.1f%% skipped", T.name, budget, 100.0 * (double)stats.cycles / (double)cycles);
+    TENSURE(stats.loops > 0 && (stats.cycles * 2 > (unsigned long long)cycles));
+
+    mem[0x200] = 1;
+    vxt_system_step(s, budget);
+    TENSURE(s->cpu.halt && (s->cpu.regs.ip == 0x10B));
+
+    test_machine_destroy(s, mem);
+)
+
 VXT_API vxt_error vxt_system_destroy(CONSTP(vxt_system) s) {
     if (s->cpu.validator) {
         vxt_error (*destroy)(void*) = s->cpu.validator->destroy;
@@ -179,11 +508,18 @@ VXT_API vxt_error vxt_system_destroy(CONSTP(vxt_system) s) {
             s->alloc(d, 0);
         }
     }
+
+    if (s->cpu.decode_cache)
+        s->alloc(s->cpu.decode_cache, 0);
+    if (s->cpu.profiler)
+        s->alloc(s->cpu.profiler, 0);
+    s->alloc(s->tables, 0);
     s->alloc(s, 0);
     return VXT_NO_ERROR;
 }
 
 VXT_API struct vxt_registers *vxt_system_registers(CONSTP(vxt_system) s) {
+    cpu_update_flags(&s->cpu);
     return &s->cpu.regs;
 }
 
@@ -203,12 +539,15 @@ VXT_API struct vxt_peripheral *vxt_allocate_peripheral(vxt_allocator *alloc, siz
 
 VXT_API void vxt_system_reset(CONSTP(vxt_system) s) {
     cpu_reset(&s->cpu);
-    s->a20 = false;
+    s->a20_mask = A20_MASK(false);
     
+    long long (*clock)(void) = s->tables->startup_clock;
     for (int i = 0; i < s->num_devices; i++) {
         CONSTSP(vxt_peripheral) d = s->devices[i];
         if (d->reset) {
+            const long long start = clock ? clock() : 0;
             vxt_error err = d->reset(vxt_peripheral_device(d), NULL);
+            if (clock) s->tables->startup_timing[i].reset = clock() - start;
             ENSURE(err == VXT_NO_ERROR);
         }
     }
@@ -220,8 +559,28 @@ VXT_API struct vxt_step vxt_system_step(CONSTP(vxt_system) s, int cycles) {
 	cpu_reset_cycle_count(&s->cpu);
 
 	for (;;) {
-		int newc = cpu_step(&s->cpu);
+		int newc = UNLIKELY(CPU_INSTRUMENTED(&s->cpu) || s->cpu.profiling) ? cpu_step(&s->cpu) : cpu_step_fast(&s->cpu);
 		int c = newc - oldc;
+
+		// A halted CPU only wakes up on an interrupt, and those are raised by timers or by the
+		// frontend between steps. Skip directly to the next timer instead of counting cycles.
+		int skip = 0;
+		if (LIKELY(!CPU_INSTRUMENTED(&s->cpu))) {
+			if (UNLIKELY(s->cpu.halt)) {
+				if ((skip = cycles_to_timer(s, c, cycles - newc)))
+					s->idle.stats.halts++;
+			} else if (s->idle.enabled) {
+				skip = idle_loop(s, c, cycles - newc);
+			}
+		}
+
+		if (skip) {
+			s->cpu.cycles += skip;
+			s->idle.stats.cycles += (unsigned long long)skip;
+			step.idle = true;
+			newc += skip;
+			c += skip;
+		}
 		oldc = newc;
 		step.cycles += c;
 		step.halted = s->cpu.halt;
@@ -230,17 +589,115 @@ VXT_API struct vxt_step vxt_system_step(CONSTP(vxt_system) s, int cycles) {
 		step.invalid = s->cpu.invalid;
 
 		if (UNLIKELY((step.err = update_timers(s, c)) != VXT_NO_ERROR))
-			return step;
+			break;
 
 		if (newc >= cycles)
-			return step;
+			break;
 	}
-}
 
+	// Frontends and monitors read the registers directly between steps.
+	cpu_update_flags(&s->cpu);
+	return step;
+}
 VXT_API void vxt_system_set_tracer(vxt_system *s, void (*tracer)(vxt_system*,vxt_pointer,vxt_byte)) {
     s->cpu.tracer = tracer;
 }
 
+VXT_API void vxt_system_set_decode_cache(CONSTP(vxt_system) s, bool enable) {
+    if (enable && !s->cpu.decode_cache) {
+        s->cpu.decode_cache = (struct decoded_inst*)s->alloc(NULL, sizeof(struct decoded_inst) * DECODE_CACHE_SIZE);
+        if (!s->cpu.decode_cache) {
+            VXT_LOG("Could not allocate decode cache!");
+            enable = false;
+        }
+    }
+    s->cpu.use_decode_cache = enable;
+    cpu_flush_decode_cache(&s->cpu);
+}
+
+VXT_API void vxt_system_set_cpu_model(CONSTP(vxt_system) s, enum vxt_cpu_model model) {
+    s->cpu_model = model;
+    cpu_set_model(&s->cpu, model);
+    cpu_fast_set_model(&s->cpu, model);
+    cpu_flush_decode_cache(&s->cpu);
+}
+
+VXT_API void vxt_system_set_fpu(CONSTP(vxt_system) s, bool enable) {
+	s->cpu.has_fpu = enable;
+}
+
+VXT_API void vxt_system_set_idle_detection(CONSTP(vxt_system) s, bool enable) {
+	s->idle.enabled = enable;
+	s->idle.matches = 0;
+}
+
+VXT_API struct vxt_idle_stats vxt_system_idle_stats(CONSTP(vxt_system) s) {
+	return s->idle.stats;
+}
+
+// The library has no clock of its own. Install and reset callbacks are only timed if the frontend provides one.
+VXT_API void vxt_system_set_startup_clock(CONSTP(vxt_system) s, long long (*clock)(void)) {
+	s->tables->startup_clock = clock;
+}
+
+VXT_API struct vxt_startup_timing vxt_system_startup_timing(CONSTP(vxt_system) s, vxt_byte idx) {
+	return s->tables->startup_timing[idx];
+}
+
+VXT_API void vxt_system_set_profiler(CONSTP(vxt_system) s, bool enable) {
+	if (enable && !s->cpu.profiler) {
+		if (!(s->cpu.profiler = (struct profiler*)s->alloc(NULL, sizeof(struct profiler)))) {
+			VXT_LOG("Could not allocate profiler!");
+			enable = false;
+		}
+		cpu_clear_profiler(&s->cpu);
+	}
+	s->cpu.profiling = enable;
+}
+
+VXT_API void vxt_system_clear_profiler(CONSTP(vxt_system) s) {
+	cpu_clear_profiler(&s->cpu);
+}
+
+// Copies the entries with the most cycles to dst, in descending order.
+static int top_entries(const struct vxt_profile_entry *src, int n, struct vxt_profile_entry *dst, int max) {
+	int num = 0;
+	for (int i = 0; i < n; i++) {
+		if (!src[i].count || ((num == max) && (src[i].cycles <= dst[num - 1].cycles)))
+			continue;
+
+		int j = (num < max) ? num++ : num - 1;
+		for (; (j > 0) && (dst[j - 1].cycles < src[i].cycles); j--)
+			dst[j] = dst[j - 1];
+		dst[j] = src[i];
+	}
+	return num;
+}
+
+VXT_API int vxt_system_profile_opcodes(CONSTP(vxt_system) s, struct vxt_profile_entry *entries, int max) {
+	if (!s->cpu.profiler || (max <= 0))
+		return 0;
+	return top_entries(s->cpu.profiler->opcodes, 0x100, entries, max);
+}
+
+VXT_API int vxt_system_profile_addresses(CONSTP(vxt_system) s, struct vxt_profile_entry *entries, int max) {
+	if (!s->cpu.profiler || (max <= 0))
+		return 0;
+	return top_entries(s->cpu.profiler->addresses, PROFILER_SIZE, entries, max);
+}
+
+// Entry points of the active calls and interrupts seen by the profiler, innermost first.
+VXT_API int vxt_system_profile_stack(CONSTP(vxt_system) s, vxt_pointer *frames, int max) {
+	const struct profiler *prof = s->cpu.profiler;
+	if (!prof)
+		return 0;
+
+	int num = 0;
+	for (int i = prof->depth - 1; (i >= 0) && (num < max); i--)
+		frames[num++] = prof->stack[i].addr;
+	return num;
+}
+
 VXT_API void vxt_system_set_validator(CONSTP(vxt_system) s, const struct vxt_validator *intrf) {
     s->cpu.validator = intrf;
 }
@@ -254,15 +711,15 @@ VXT_API void *vxt_system_userdata(CONSTP(vxt_system) s) {
 }
 
 VXT_API const vxt_byte *vxt_system_io_map(vxt_system *s) {
-    return s->io_map;
+    return s->tables->io_map;
 }
 
 VXT_API const vxt_byte *vxt_system_mem_map(vxt_system *s) {
-    return s->mem_map;
+    return s->tables->mem_map;
 }
 
 VXT_API const struct vxt_monitor *vxt_system_monitor(vxt_system *s, vxt_byte idx) {
-    struct vxt_monitor *m = &s->monitors[idx];
+    struct vxt_monitor *m = &s->tables->monitors[idx];
     return m->flags ? m : NULL;
 }
 
@@ -296,6 +753,11 @@ VXT_API enum vxt_pclass vxt_peripheral_class(struct vxt_peripheral *p) {
     return p->pclass ? p->pclass(vxt_peripheral_device(p)) : VXT_PCLASS_GENERIC;
 }
 
+// The PIC calls this whenever its registers change, so the CPU does not have to poll it every instruction.
+VXT_API void vxt_system_set_interrupt_pending(CONSTP(vxt_system) s, bool pending) {
+    s->cpu.irq_pending = pending;
+}
+
 VXT_API void vxt_system_wait(CONSTP(vxt_system) s, int cycles) {
     s->cpu.cycles += cycles;
 }
@@ -306,6 +768,11 @@ VXT_API void vxt_system_interrupt(CONSTP(vxt_system) s, int n) {
         s->cpu.pic->pic.irq(vxt_peripheral_device(s->cpu.pic), n);
 }
 
+// The PC/XT NMI mask register. Bit 7 of port A0h.
+VXT_API void vxt_system_set_nmi(CONSTP(vxt_system) s, bool enable) {
+    cpu_update_nmi(&s->cpu, enable, s->cpu.fpu_int);
+}
+
 VXT_API int vxt_system_frequency(CONSTP(vxt_system) s) {
     return s->frequency;
 }
@@ -315,12 +782,12 @@ VXT_API void vxt_system_set_frequency(CONSTP(vxt_system) s, int freq) {
 }
 
 VXT_API void vxt_system_set_a20(CONSTP(vxt_system) s, bool enable) {
-	s->a20 = enable;
+	s->a20_mask = A20_MASK(enable);
 }
 
 VXT_API void vxt_system_install_monitor(CONSTP(vxt_system) s, struct vxt_peripheral *dev, const char *name, void *reg, enum vxt_monitor_flag flags) {
-	if (s->num_monitors < VXT_MAX_MONITORS)
-		s->monitors[s->num_monitors++] = (struct vxt_monitor){ dev ? vxt_peripheral_name(dev) : "CPU", name, reg, flags };
+	if (s->tables->num_monitors < VXT_MAX_MONITORS)
+		s->tables->monitors[s->tables->num_monitors++] = (struct vxt_monitor){ dev ? vxt_peripheral_name(dev) : "CPU", name, reg, flags };
 }
 
 VXT_API vxt_timer_id vxt_system_install_timer(CONSTP(vxt_system) s, struct vxt_peripheral *dev, unsigned int us) {
@@ -351,14 +818,39 @@ VXT_API bool vxt_system_set_timer_interval(vxt_system *s, vxt_timer_id id, unsig
 
 VXT_API void vxt_system_install_io_at(CONSTP(vxt_system) s, struct vxt_peripheral *dev, vxt_word addr) {
 	VERIFY_PERIPHERAL(dev,);
-	s->io_map[addr] = ((struct peripheral*)dev)->idx;
+	s->tables->io_map[addr] = ((struct peripheral*)dev)->idx;
 }
 
 VXT_API void vxt_system_install_io(CONSTP(vxt_system) s, struct vxt_peripheral *dev, vxt_word from, vxt_word to) {
 	VERIFY_PERIPHERAL(dev,);
 	int i = (int)from;
 	while (i <= (int)to)
-		s->io_map[i++] = ((struct peripheral*)dev)->idx;
+		s->tables->io_map[i++] = ((struct peripheral*)dev)->idx;
+}
+
+static void unmap_mem_page(CONSTP(vxt_system) s, vxt_pointer page) {
+	struct mem_page *mp = &s->mem_pages[page];
+	mp->read = mp->write = NULL;
+	mp->writable = false;
+	mp->code = 0;
+
+	// Drop decoded instructions.
+	for (int i = 0; i < (MEM_PAGE_SIZE >> CODE_LINE_SHIFT); i++)
+		s->tables->code_gen[(page << (MEM_PAGE_SHIFT - CODE_LINE_SHIFT)) + i]++;
+}
+
+// Instructions can cross into the next code line so the line before is invalidated as well.
+static void invalidate_code(CONSTP(vxt_system) s, struct mem_page *mp, vxt_pointer addr) {
+	const vxt_dword line = 1u << ((addr & MEM_PAGE_MASK) >> CODE_LINE_SHIFT);
+	const vxt_dword mask = line | (line >> 1);
+	if (mp->code & mask) {
+		mp->code &= ~mask;
+		s->tables->code_gen[addr >> CODE_LINE_SHIFT]++;
+		if (addr >> CODE_LINE_SHIFT)
+			s->tables->code_gen[(addr >> CODE_LINE_SHIFT) - 1]++;
+		if (!mp->code)
+			mp->write = mp->read;
+	}
 }
 
 VXT_API void vxt_system_install_mem(CONSTP(vxt_system) s, struct vxt_peripheral *dev, vxt_pointer from, vxt_pointer to) {
@@ -369,50 +861,176 @@ VXT_API void vxt_system_install_mem(CONSTP(vxt_system) s, struct vxt_peripheral
 	if ((from | (to + 1)) & 0xF)
 		VXT_LOG("ERROR: Trying to register unaligned address!");
 
+	// Any direct mapping in this range is no longer valid.
+	for (vxt_pointer i = from >> MEM_PAGE_SHIFT; (i <= (to >> MEM_PAGE_SHIFT)) && (i < NUM_MEM_PAGES); i++)
+		unmap_mem_page(s, i);
+
 	from = from >> 4;
 	to = to >> 4;
 	while (from <= to)
-		s->mem_map[from++] = ((struct peripheral*)dev)->idx;
+		s->tables->mem_map[from++] = ((struct peripheral*)dev)->idx;
 }
 
-VXT_API vxt_byte vxt_system_read_byte(CONSTP(vxt_system) s, vxt_pointer addr) {
-	if (!s->a20)
-		addr &= 0xEFFFFF;
-		
-	if (addr >= 0x100000) {
-		addr -= 0x100000;
-		return (addr >= EXT_MEM_SIZE) ? 0xFF : s->ext_mem[addr];
+VXT_API void vxt_system_map_mem_pointer(CONSTP(vxt_system) s, struct vxt_peripheral *dev, vxt_pointer from, vxt_pointer to, vxt_byte *data, bool read_only) {
+	VERIFY_PERIPHERAL(dev,);
+	if ((from | to) & ~0xFFFFF) {
+		VXT_LOG("ERROR: Trying to map memory above 1MB!");
+		return;
+	}
+
+	const vxt_byte idx = ((struct peripheral*)dev)->idx;
+	vxt_pointer page = (from + MEM_PAGE_MASK) >> MEM_PAGE_SHIFT;
+
+	// Only pages that are completely covered, and still owned by the device, can be accessed directly.
+	for (; (page << MEM_PAGE_SHIFT) + MEM_PAGE_MASK <= to; page++) {
+		const vxt_pointer addr = page << MEM_PAGE_SHIFT;
+		struct mem_page *mp = &s->mem_pages[page];
+		unmap_mem_page(s, page);
+
+		int i = addr >> 4;
+		for (; i < (int)((addr + MEM_PAGE_SIZE) >> 4); i++) {
+			if (s->tables->mem_map[i] != idx)
+				break;
+		}
+
+		if (data && (i == (int)((addr + MEM_PAGE_SIZE) >> 4))) {
+			mp->read = data + (addr - from);
+			mp->write = read_only ? NULL : mp->read;
+			mp->writable = !read_only;
+		}
 	}
+}
+
+VXT_API vxt_byte vxt_system_read_byte(CONSTP(vxt_system) s, vxt_pointer addr) {
+	addr &= s->a20_mask;
+	if (UNLIKELY(addr >= MEM_SPACE_SIZE))
+		return 0xFF;
+
+	const vxt_byte *page = s->mem_pages[addr >> MEM_PAGE_SHIFT].read;
+	if (LIKELY(page != NULL))
+		return page[addr & MEM_PAGE_MASK];
 
-	CONSTSP(vxt_peripheral) dev = s->devices[s->mem_map[addr >> 4]];
-	return dev->io.read(vxt_peripheral_device(dev), addr);
+	const vxt_byte idx = s->tables->mem_map[addr >> 4];
+	VERIFY_DISPATCH(s, idx);
+	return s->io[idx].read(s->io[idx].dev, addr);
 }
 
 VXT_API void vxt_system_write_byte(CONSTP(vxt_system) s, vxt_pointer addr, vxt_byte data) {
-	if (!s->a20)
-		addr &= 0xEFFFFF;
-		
-	if (addr >= 0x100000) {
-		addr -= 0x100000;
-		if (addr < EXT_MEM_SIZE)
-			s->ext_mem[addr] = data;
+	addr &= s->a20_mask;
+	if (UNLIKELY(addr >= MEM_SPACE_SIZE))
+		return;
+
+	struct mem_page *mp = &s->mem_pages[addr >> MEM_PAGE_SHIFT];
+	if (LIKELY(mp->write != NULL)) {
+		mp->write[addr & MEM_PAGE_MASK] = data;
+		return;
+	} else if (UNLIKELY(mp->code)) {
+		// Self-modifying code or new code loaded over old.
+		invalidate_code(s, mp, addr);
+		mp->read[addr & MEM_PAGE_MASK] = data;
 		return;
 	}
-	
-	CONSTSP(vxt_peripheral) dev = s->devices[s->mem_map[addr >> 4]];
-	dev->io.write(vxt_peripheral_device(dev), addr, data);
+
+	const vxt_byte idx = s->tables->mem_map[addr >> 4];
+	VERIFY_DISPATCH(s, idx);
+	s->io[idx].write(s->io[idx].dev, addr, data);
+}
+
+// Both bytes of a word are in the same page, and the same device, unless it crosses a paragraph
+// at the end of a page. Everything else falls back to two byte accesses.
+VXT_API vxt_word vxt_system_read_word(CONSTP(vxt_system) s, vxt_pointer addr) {
+	const vxt_pointer a = addr & s->a20_mask;
+	if (LIKELY((a < MEM_SPACE_SIZE) && ((a & MEM_PAGE_MASK) != MEM_PAGE_MASK))) {
+		const vxt_byte *page = s->mem_pages[a >> MEM_PAGE_SHIFT].read;
+		if (LIKELY(page != NULL)) {
+			page += a & MEM_PAGE_MASK;
+			return WORD(page[1], page[0]);
+		}
+
+		const struct io_dispatch *d = &s->io[s->tables->mem_map[a >> 4]];
+		if (d->read16 && ((a & 0xF) != 0xF))
+			return d->read16(d->dev, a);
+	}
+
+	const vxt_byte l = vxt_system_read_byte(s, addr);
+	return WORD(vxt_system_read_byte(s, addr + 1), l);
+}
+
+VXT_API void vxt_system_write_word(CONSTP(vxt_system) s, vxt_pointer addr, vxt_word data) {
+	const vxt_pointer a = addr & s->a20_mask;
+	if (LIKELY((a < MEM_SPACE_SIZE) && ((a & MEM_PAGE_MASK) != MEM_PAGE_MASK))) {
+		struct mem_page *mp = &s->mem_pages[a >> MEM_PAGE_SHIFT];
+		if (LIKELY(mp->write != NULL)) {
+			vxt_byte *ptr = &mp->write[a & MEM_PAGE_MASK];
+			ptr[0] = LBYTE(data);
+			ptr[1] = HBYTE(data);
+			return;
+		}
+
+		const struct io_dispatch *d = &s->io[s->tables->mem_map[a >> 4]];
+		if (d->write16 && !mp->code && ((a & 0xF) != 0xF)) {
+			d->write16(d->dev, a, data);
+			return;
+		}
+	}
+
+	vxt_system_write_byte(s, addr, LBYTE(data));
+	vxt_system_write_byte(s, addr + 1, HBYTE(data));
+}
+
+// Block transfers are split at page boundaries. The A20 mask can only change the address of a whole page,
+// so each chunk is contiguous. Pages without a direct pointer, or with decoded code, use byte accesses.
+VXT_API void vxt_system_read_block(CONSTP(vxt_system) s, vxt_pointer addr, vxt_byte *data, int size) {
+	while (size > 0) {
+		const vxt_pointer a = addr & s->a20_mask;
+		const int offset = a & MEM_PAGE_MASK;
+		const int n = (size < (MEM_PAGE_SIZE - offset)) ? size : (MEM_PAGE_SIZE - offset);
+		const vxt_byte *page = (a < MEM_SPACE_SIZE) ? s->mem_pages[a >> MEM_PAGE_SHIFT].read : NULL;
+
+		if (LIKELY(page != NULL)) {
+			memcpy(data, &page[offset], n);
+		} else {
+			for (int i = 0; i < n; i++)
+				data[i] = vxt_system_read_byte(s, addr + i);
+		}
+		addr += n;
+		data += n;
+		size -= n;
+	}
+}
+
+VXT_API void vxt_system_write_block(CONSTP(vxt_system) s, vxt_pointer addr, const vxt_byte *data, int size) {
+	while (size > 0) {
+		const vxt_pointer a = addr & s->a20_mask;
+		const int offset = a & MEM_PAGE_MASK;
+		const int n = (size < (MEM_PAGE_SIZE - offset)) ? size : (MEM_PAGE_SIZE - offset);
+		vxt_byte *page = (a < MEM_SPACE_SIZE) ? s->mem_pages[a >> MEM_PAGE_SHIFT].write : NULL;
+
+		if (LIKELY(page != NULL)) {
+			memcpy(&page[offset], data, n);
+		} else {
+			for (int i = 0; i < n; i++)
+				vxt_system_write_byte(s, addr + i, data[i]);
+		}
+		addr += n;
+		data += n;
+		size -= n;
+	}
 }
 
 vxt_byte system_in(CONSTP(vxt_system) s, vxt_word port) {
-    CONSTSP(vxt_peripheral) dev = s->devices[s->io_map[port]];
+    const vxt_byte idx = s->tables->io_map[port];
+    VERIFY_DISPATCH(s, idx);
     s->cpu.bus_transfers++;
     VALIDATOR_DISCARD(&s->cpu);
-    return dev->io.in(vxt_peripheral_device(dev), port);
+    return s->io[idx].in(s->io[idx].dev, port);
 }
 
 void system_out(CONSTP(vxt_system) s, vxt_word port, vxt_byte data) {
-    CONSTSP(vxt_peripheral) dev = s->devices[s->io_map[port]];
+    const vxt_byte idx = s->tables->io_map[port];
+    VERIFY_DISPATCH(s, idx);
     s->cpu.bus_transfers++;
+    s->cpu.side_effect = true;
     VALIDATOR_DISCARD(&s->cpu);
-    dev->io.out(vxt_peripheral_device(dev), port, data);
+    s->io[idx].out(s->io[idx].dev, port, data);
 }
@@ -32,6 +32,22 @@
  // Set this to 64K (not 64-16) because anything less causes problem with himem.sys.
 #define EXT_MEM_SIZE 0x10000
 
+// Granularity of the direct memory page table. 2K is the smallest option ROM size.
+#define MEM_PAGE_SHIFT 11
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_SHIFT)
+#define MEM_PAGE_MASK (MEM_PAGE_SIZE - 1)
+#define NUM_MEM_PAGES (MEM_SPACE_SIZE >> MEM_PAGE_SHIFT)
+
+// Conventional memory followed by the HMA. The HMA pages always point into ext_mem.
+#define MEM_SPACE_SIZE (0x100000 + EXT_MEM_SIZE)
+
+// Clearing bit 20 wraps HMA accesses around to the start of memory.
+#define A20_MASK(e) ( (e) ? (vxt_pointer)-1 : (vxt_pointer)~0x100000 )
+
+// Granularity of decode cache invalidation.
+#define CODE_LINE_SHIFT 6
+#define NUM_CODE_LINES (0x100000 >> CODE_LINE_SHIFT)
+
 #define VERIFY_PERIPHERAL(p, r)										\
 	if (((struct peripheral*)(p))->sig != PERIPHERAL_SIGNATURE) {	\
 		VXT_LOG("Invalid peripheral!");								\
@@ -45,6 +61,38 @@ struct timer {
    double interval;
 };
 
+// Host pointers to the start of a memory page. NULL means the access
+// must be dispatched to the peripheral that owns the page.
+struct mem_page {
+   vxt_byte *read;
+   vxt_byte *write;
+
+   // Pages holding decoded instructions have their write pointer removed
+   // so that writes can invalidate the decode cache. Each bit in the code
+   // mask covers one code line of the page.
+   bool writable;
+   vxt_dword code;
+};
+
+// Loops longer than this, in bytes, are never considered idle.
+#define IDLE_MAX_LOOP 64
+// Number of identical iterations before a loop is considered idle.
+#define IDLE_MATCHES 2
+// Number of other short backward jumps before the detector moves on to a new loop.
+#define IDLE_MAX_MISSES 8
+
+// State of the last loop iteration seen by the idle detector.
+struct idle {
+   bool enabled;
+   int matches, misses;
+   int cycles, loop_cycles;
+   vxt_pointer head;
+   vxt_dword hash;
+   int queue_count, biu_cycles;
+   struct vxt_registers regs;
+   struct vxt_idle_stats stats;
+};
+
 struct peripheral {
     struct vxt_peripheral p;
     vxt_system *s;
@@ -56,26 +104,60 @@ struct peripheral {
 
 _Static_assert(sizeof(struct peripheral) % 4 == 0, "invalid struct size");
 
-struct system {
-   void *userdata;
+// Resolved device pointer and bus callbacks of a peripheral. The I/O and memory maps
+// index this table directly, so an access does not need to look at the peripheral.
+struct io_dispatch {
+   void *dev;
+   vxt_byte (*in)(void*,vxt_word);
+   void (*out)(void*,vxt_word,vxt_byte);
+   vxt_byte (*read)(void*,vxt_pointer);
+   void (*write)(void*,vxt_pointer,vxt_byte);
+   vxt_word (*read16)(void*,vxt_pointer);
+   void (*write16)(void*,vxt_pointer,vxt_word);
+};
 
+#ifdef NDEBUG
+   #define VERIFY_DISPATCH(s, idx)
+#else
+   #define VERIFY_DISPATCH(s, idx) ENSURE(((struct peripheral*)(s)->devices[(idx)])->sig == PERIPHERAL_SIGNATURE)
+#endif
+
+// Maps and debugging tables that are not used by the instruction loop. They are
+// allocated separately, so they don't spread the hot state over many pages.
+struct system_tables {
    vxt_byte io_map[VXT_IO_MAP_SIZE];
    vxt_byte mem_map[VXT_MEM_MAP_SIZE];
    vxt_byte ext_mem[EXT_MEM_SIZE];
+   unsigned int code_gen[NUM_CODE_LINES];
 
-   vxt_allocator *alloc;
+   int num_monitors;
+   struct vxt_monitor monitors[VXT_MAX_MONITORS];
+
+   long long (*startup_clock)(void);
+   struct vxt_startup_timing startup_timing[VXT_MAX_PERIPHERALS];
+};
+
+struct system {
+   // The CPU keeps its per-instruction state at the start of the struct.
    struct cpu cpu;
-   int frequency;
-   bool a20;
 
+   vxt_pointer a20_mask;
+   int frequency;
    int num_timers;
    struct timer timers[MAX_TIMERS];
 
-   int num_monitors;
-   struct vxt_monitor monitors[VXT_MAX_MONITORS];
+   struct mem_page mem_pages[NUM_MEM_PAGES];
+   struct system_tables *tables;
+
+   struct idle idle;
+
+   void *userdata;
+   vxt_allocator *alloc;
+   enum vxt_cpu_model cpu_model;
 
    int num_devices;
    struct vxt_peripheral *devices[VXT_MAX_PERIPHERALS];
+   struct io_dispatch io[VXT_MAX_PERIPHERALS];
    struct peripheral dummy;
 };
 
@@ -30,8 +30,11 @@ extern "C" {
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 
+#include <vxt/vxt.h>
+
 static struct Test {
    const char *name;
    FILE *output;
@@ -44,6 +47,7 @@ static struct Test {
 #define TENSURE(e)         TASSERT((e), "%s", "ENSURE failed!")
 #define TENSURE_NO_ERR(e)  { vxt_error __err = (e); TASSERT(__err == VXT_NO_ERROR, "%s", vxt_error_str(__err)); }
 #define TEST(n, ...)       int test_ ## n (struct Test T) { T.name = #n ; { __VA_ARGS__ } return 0; }
+#define BENCH(n, ...)      int bench_ ## n (struct Test T) { T.name = #n ; { __VA_ARGS__ } return 0; }
 #define TLOG(...)          { fprintf(T.output, __VA_ARGS__); fprintf(T.output, "%s", "\n"); }
 #define TALLOC             realloc
 #define TFREE(p)           { void *_ = realloc(p, 0); (void)_; }
@@ -53,6 +57,35 @@ static bool run_test(int (*t)(struct Test T)) {
    return t(test_state) == 0;
 }
 
+#define TEST_MEMORY_SIZE   0x10000
+#define TEST_CODE_OFFSET   0x100
+
+// Creates a system with 64KB of host RAM at address 0, mapped through the dummy device.
+// The code is copied to 0000:0100 and the CPU is reset to start executing it.
+static vxt_system *test_machine_create(vxt_byte **mem, struct vxt_peripheral * const devices[], const vxt_byte *code, int size) {
+   *mem = (vxt_byte*)TALLOC(NULL, TEST_MEMORY_SIZE);
+   vxt_system *s = vxt_system_create(TALLOC, VXT_DEFAULT_FREQUENCY, devices);
+   if (!*mem || !s || (vxt_system_initialize(s) != VXT_NO_ERROR))
+      return NULL;
+
+   memset(*mem, 0, TEST_MEMORY_SIZE);
+   if (code)
+      memcpy(&(*mem)[TEST_CODE_OFFSET], code, size);
+   vxt_system_map_mem_pointer(s, vxt_system_peripheral(s, 0), 0, TEST_MEMORY_SIZE - 1, *mem, false);
+   vxt_system_reset(s);
+
+   struct vxt_registers *r = vxt_system_registers(s);
+   r->cs = r->ss = r->ds = r->es = 0;
+   r->ip = TEST_CODE_OFFSET;
+   r->sp = 0x1000;
+   return s;
+}
+
+static void test_machine_destroy(vxt_system *s, vxt_byte *mem) {
+   vxt_system_destroy(s);
+   TFREE(mem);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -62,5 +95,6 @@ static bool run_test(int (*t)(struct Test T)) {
 #else
 
 #define TEST(n, c)
+#define BENCH(n, c)
 
 #endif
@@ -21,6 +21,32 @@
 
 #include <vxt/vxtu.h>
 
+// Fills memory with garbage so guest software can't rely on it being cleared.
+// Four interleaved xorshift generators keep the loop free of dependencies between lanes.
+VXT_API void vxtu_randomize(void *ptr, int size, intptr_t seed) {
+    vxt_dword state[4];
+    for (int i = 0; i < 4; i++)
+        state[i] = ((vxt_dword)seed + (vxt_dword)i) * 0x9E3779B1u | 1;
+
+    vxt_byte *dst = (vxt_byte*)ptr;
+    int i = 0;
+    for (; (i + 16) <= size; i += 16) {
+        for (int j = 0; j < 4; j++) {
+            vxt_dword x = state[j];
+            x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+            state[j] = x;
+            memcpy(&dst[i + j * 4], &x, 4);
+        }
+    }
+
+    for (; i < size; i++) {
+        vxt_dword x = state[0];
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        state[0] = x;
+        dst[i] = (vxt_byte)x;
+    }
+}
+
 #ifdef VXT_NO_LIBC
 
 vxt_byte *vxtu_read_file(vxt_allocator *alloc, const char *file, int *size) {
@@ -29,7 +55,27 @@ vxt_byte *vxtu_read_file(vxt_allocator *alloc, const char *file, int *size) {
     return NULL;
 }
 
+void *vxtu_map_file(const char *file, int *size) {
+    (void)file; (void)size;
+    VXT_LOG("ERROR: libvxt is built with VXT_NO_LIBC!");
+    return NULL;
+}
+
+void vxtu_unmap_file(void *mapping, int size) {
+    (void)mapping; (void)size;
+}
+
+#else
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
 #else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
 
 vxt_byte *vxtu_read_file(vxt_allocator *alloc, const char *file, int *size) {
     vxt_byte *data = NULL;
@@ -56,4 +102,60 @@ error:
     return data;
 }
 
+#ifdef _WIN32
+
+void *vxtu_map_file(const char *file, int *size) {
+    HANDLE fh = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fh == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    void *mapping = NULL;
+    DWORD sz = GetFileSize(fh, NULL);
+    if ((sz != INVALID_FILE_SIZE) && (sz > 0)) {
+        HANDLE mh = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mh) {
+            // The view keeps the mapping alive after the handles are closed.
+            mapping = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mh);
+        }
+    }
+    CloseHandle(fh);
+
+    if (mapping && size)
+        *size = (int)sz;
+    return mapping;
+}
+
+void vxtu_unmap_file(void *mapping, int size) {
+    (void)size;
+    UnmapViewOfFile(mapping);
+}
+
+#else
+
+void *vxtu_map_file(const char *file, int *size) {
+    int fd = open(file, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    void *mapping = NULL;
+    struct stat st;
+    if (!fstat(fd, &st) && (st.st_size > 0)) {
+        mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED)
+            mapping = NULL;
+    }
+    close(fd);
+
+    if (mapping && size)
+        *size = (int)st.st_size;
+    return mapping;
+}
+
+void vxtu_unmap_file(void *mapping, int size) {
+    munmap(mapping, (size_t)size);
+}
+
+#endif
+
 #endif
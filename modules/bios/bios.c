@@ -43,16 +43,9 @@ static struct vxt_peripheral *bios_create(vxt_allocator *alloc, void *frontend,
     if (fi && fi->resolve_path)
         path = fi->resolve_path(FRONTEND_BIOS_PATH, path);
 
-    int size = 0;
-    vxt_byte *data = vxtu_read_file(alloc, path, &size);
-    if (!data) {
+    struct vxt_peripheral *p = vxtu_rom_map(alloc, base, path);
+    if (!p)
         VXT_LOG("Could not load BIOS image: %s", path );
-        return NULL;
-    }
-
-    struct vxt_peripheral *p = vxtu_memory_create(alloc, base, size, true);
-    vxtu_memory_device_fill(p, data, size);
-    alloc(data, 0);
     return p;
 }
 
@@ -110,6 +110,19 @@ static const char *command_to_string(int cmd) {
 	return "UNSUPPORTED COMMAND";
 }
 
+// Buffers are addressed as seg:off and wrap around at the end of the segment, like the byte loop they replace.
+static void read_segment(vxt_system *s, vxt_word seg, vxt_word off, vxt_byte *data, int size) {
+	const int n = (size < (0x10000 - off)) ? size : (0x10000 - off);
+	vxt_system_read_block(s, VXT_POINTER(seg, off), data, n);
+	vxt_system_read_block(s, VXT_POINTER(seg, 0), &data[n], size - n);
+}
+
+static void write_segment(vxt_system *s, vxt_word seg, vxt_word off, const vxt_byte *data, int size) {
+	const int n = (size < (0x10000 - off)) ? size : (0x10000 - off);
+	vxt_system_write_block(s, VXT_POINTER(seg, off), data, n);
+	vxt_system_write_block(s, VXT_POINTER(seg, 0), &data[n], size - n);
+}
+
 static vxt_byte in(struct ebridge *n, vxt_word port) {
 	(void)n; (void)port;
 	return 0; // Return 0 to indicate that we have a network card.
@@ -170,8 +183,7 @@ static void out(struct ebridge *n, vxt_word port, vxt_byte data) {
 				return;
 			}
 
-			for (int i = 0; i < (int)r->cx; i++)
-				n->buffer[i] = vxt_system_read_byte(s, VXT_POINTER(r->ds, r->si + i));
+			read_segment(s, r->ds, r->si, n->buffer, r->cx);
 
 			if (sendto(n->sockfd, (void*)n->buffer, r->cx, 0, (const struct sockaddr*)&n->addr, sizeof(n->addr)) != r->cx)
 				VXT_LOG("Could not send packet!");
@@ -188,8 +200,7 @@ static void out(struct ebridge *n, vxt_word port, vxt_byte data) {
 			}
 
 			r->cx = 6;
-			for (int i = 0; i < (int)r->cx; i++)
-				vxt_system_write_byte(s, VXT_POINTER(r->es, r->di + i), n->mac_addr[i]);
+			write_segment(s, r->es, r->di, n->mac_addr, r->cx);
 			break;
 		case RESET_INTERFACE: LOG_COMMAND
 			ENSURE_HANDLE;
@@ -206,8 +217,7 @@ static void out(struct ebridge *n, vxt_word port, vxt_byte data) {
 		case 0xFF: // copy_package
 			// Do we have a valid buffer?
 			if (r->es || r->di) {
-				for (int i = 0; i < n->rx_len; i++)
-					vxt_system_write_byte(s, VXT_POINTER(r->es, r->di + i), n->rx_buffer[i]);
+				write_segment(s, r->es, r->di, n->rx_buffer, n->rx_len);
 
 				// Callback expects buffer in DS:SI
 				r->ds = r->es;
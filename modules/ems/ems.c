@@ -24,18 +24,53 @@
 #include <vxt/vxtu.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-// The Lo-tech EMS board driver is hardcoded to 2MB.
-#define MEMORY_SIZE 0x200000
+// The page selectors are 8-bit so the board can address at most 4MB.
+// The original Lo-tech board is 2MB and that is what the driver expects by default.
+#define PAGE_SIZE 0x4000
+#define MAX_PAGES 256
+#define DEFAULT_PAGES 128
 
 struct ems {
- 	vxt_byte mem[MEMORY_SIZE];
+    // Pages are allocated on first write. Untouched pages read as 'blank'.
+    vxt_byte *pages[MAX_PAGES];
+    vxt_byte blank[PAGE_SIZE];
+    int num_pages;
+    char name[32];
+
     vxt_pointer mem_base;
     vxt_word io_base;
     vxt_byte page_selectors[4];
 };
 
+static vxt_byte *page_pointer(struct ems *m, int window) {
+    const int page = m->page_selectors[window];
+    if (page >= m->num_pages)
+        return NULL;
+    return m->pages[page] ? m->pages[page] : m->blank;
+}
+
+static bool aliased(struct ems *m, int window) {
+    for (int i = 0; i < 4; i++) {
+        if ((i != window) && (m->page_selectors[i] == m->page_selectors[window]))
+            return true;
+    }
+    return false;
+}
+
+// Windows are mapped directly to the host pages. Writes to untouched pages, accesses to pages
+// outside the board and pages visible in more than one window end up in the device callbacks.
+// Writes through one alias would otherwise not invalidate decoded code at the other.
+static void map_window(struct ems *m, int window) {
+    const vxt_pointer from = m->mem_base + (vxt_pointer)window * PAGE_SIZE;
+    const int page = m->page_selectors[window];
+    const bool allocated = (page < m->num_pages) && m->pages[page];
+    vxt_byte *ptr = aliased(m, window) ? NULL : page_pointer(m, window);
+    vxt_system_map_mem_pointer(VXT_GET_SYSTEM(m), VXT_GET_PERIPHERAL(m), from, from + PAGE_SIZE - 1, ptr, !allocated);
+}
+
 static vxt_byte in(struct ems *m, vxt_word port) {
     (void)m; (void)port;
     VXT_LOG("Register read is not supported!");
@@ -43,43 +78,114 @@ static vxt_byte in(struct ems *m, vxt_word port) {
 }
 
 static void out(struct ems *m, vxt_word port, vxt_byte data) {
-    int sel = port - m->io_base;
-    m->page_selectors[sel & 3] = data;
+    const int window = (port - m->io_base) & 3;
+    const vxt_byte old = m->page_selectors[window];
+    if (old != data) {
+        m->page_selectors[window] = data;
+
+        // Other windows showing the old or the new page can change aliasing.
+        for (int i = 0; i < 4; i++) {
+            if ((i == window) || (m->page_selectors[i] == old) || (m->page_selectors[i] == data))
+                map_window(m, i);
+        }
+    }
 }
 
-static vxt_pointer physical_address(struct ems *m, vxt_pointer addr) {
-    vxt_pointer frame_addr = addr - m->mem_base;
-    vxt_pointer page_addr = frame_addr & 0x3FFF;
-    vxt_byte selector = m->page_selectors[(frame_addr >> 14) & 3];
-    return selector * 0x4000 + page_addr;
+static vxt_byte read(struct ems *m, vxt_pointer addr) {
+    const vxt_pointer frame_addr = addr - m->mem_base;
+    const vxt_byte *ptr = page_pointer(m, (frame_addr >> 14) & 3);
+    return ptr ? ptr[frame_addr & (PAGE_SIZE - 1)] : 0xFF;
 }
 
-static vxt_byte read(struct ems *m, vxt_pointer addr) {
-    vxt_pointer phys_addr = physical_address(m, addr);
-    return (phys_addr < MEMORY_SIZE) ? m->mem[phys_addr] : 0xFF;
+// Untouched pages are allocated on the first write. Returns NULL for pages outside the board.
+static vxt_byte *writable_page(struct ems *m, int window) {
+    const int page = m->page_selectors[window];
+    if (page >= m->num_pages)
+        return NULL;
+
+    if (!m->pages[page]) {
+        vxt_byte *ptr = (vxt_byte*)vxt_system_allocator(VXT_GET_SYSTEM(m))(NULL, PAGE_SIZE);
+        if (!ptr) {
+            VXT_LOG("Could not allocate EMS page!");
+            return NULL;
+        }
+        memcpy(ptr, m->blank, PAGE_SIZE);
+        m->pages[page] = ptr;
+
+        // The same page can be visible in more than one window.
+        for (int i = 0; i < 4; i++) {
+            if (m->page_selectors[i] == page)
+                map_window(m, i);
+        }
+    }
+    return m->pages[page];
 }
 
 static void write(struct ems *m, vxt_pointer addr, vxt_byte data) {
-    vxt_pointer phys_addr = physical_address(m, addr);
-    if (phys_addr < MEMORY_SIZE)
-        m->mem[phys_addr] = data;
+    const vxt_pointer frame_addr = addr - m->mem_base;
+    vxt_byte *ptr = writable_page(m, (frame_addr >> 14) & 3);
+    if (ptr)
+        ptr[frame_addr & (PAGE_SIZE - 1)] = data;
+}
+
+// Both bytes are in the same paragraph, so they are also in the same EMS page.
+static vxt_word read16(struct ems *m, vxt_pointer addr) {
+    const vxt_pointer frame_addr = addr - m->mem_base;
+    const vxt_byte *ptr = page_pointer(m, (frame_addr >> 14) & 3);
+    if (!ptr)
+        return 0xFFFF;
+    ptr += frame_addr & (PAGE_SIZE - 1);
+    return ((vxt_word)ptr[1] << 8) | ptr[0];
+}
+
+static void write16(struct ems *m, vxt_pointer addr, vxt_word data) {
+    const vxt_pointer frame_addr = addr - m->mem_base;
+    vxt_byte *ptr = writable_page(m, (frame_addr >> 14) & 3);
+    if (ptr) {
+        ptr += frame_addr & (PAGE_SIZE - 1);
+        ptr[0] = (vxt_byte)(data & 0xFF);
+        ptr[1] = (vxt_byte)(data >> 8);
+    }
 }
 
 static vxt_error install(struct ems *m, vxt_system *s) {
     struct vxt_peripheral *p = VXT_GET_PERIPHERAL(m);
     vxt_system_install_io(s, p, m->io_base, m->io_base + 3);
     vxt_system_install_mem(s, p, m->mem_base, m->mem_base + 0xFFFF);
+
+    for (int i = 0; i < 4; i++)
+        map_window(m, i);
+    return VXT_NO_ERROR;
+}
+
+static vxt_error destroy(struct ems *m) {
+    vxt_allocator *alloc = vxt_system_allocator(VXT_GET_SYSTEM(m));
+    for (int i = 0; i < MAX_PAGES; i++) {
+        if (m->pages[i])
+            alloc(m->pages[i], 0);
+    }
+    alloc(VXT_GET_PERIPHERAL(m), 0);
     return VXT_NO_ERROR;
 }
 
 static const char *name(struct ems *m) {
-    (void)m; return "Lo-tech 2MB EMS Board";
+    return m->name;
+}
+
+static void set_size(struct ems *m, int kb) {
+    if ((kb < 16) || (kb > (MAX_PAGES * PAGE_SIZE / 1024)) || (kb % 16)) {
+        VXT_LOG("Invalid EMS size: %dKB", kb);
+        return;
+    }
+    m->num_pages = kb / 16;
+    snprintf(m->name, sizeof(m->name), "Lo-tech %dKB EMS Board", kb);
 }
 
 static vxt_error config(struct ems *m, const char *section, const char *key, const char *value) {
     if (!strcmp("lotech_ems", section)) {
         if (!strcmp("memory", key)) sscanf(value, "%x", &m->mem_base);
         else if (!strcmp("port", key)) sscanf(value, "%hx", &m->io_base);
+        else if (!strcmp("size", key)) set_size(m, atoi(value));
     }
     return VXT_NO_ERROR;
 }
@@ -88,16 +194,21 @@ VXTU_MODULE_CREATE(ems, {
     if (strcmp(ARGS, "lotech_ems"))
         return NULL;
 
-    vxtu_randomize(DEVICE->mem, MEMORY_SIZE, (intptr_t)PERIPHERAL);
+    // Fixed seed so untouched pages read the same on every run.
+    vxtu_randomize(DEVICE->blank, PAGE_SIZE, 0x4000);
+    set_size(DEVICE, DEFAULT_PAGES * PAGE_SIZE / 1024);
 
     DEVICE->mem_base = 0xE0000;
     DEVICE->io_base = 0x260;
 
     PERIPHERAL->install = &install;
+    PERIPHERAL->destroy = &destroy;
     PERIPHERAL->config = &config;
     PERIPHERAL->name = &name;
     PERIPHERAL->io.read = &read;
     PERIPHERAL->io.write = &write;
+    PERIPHERAL->io16.read16 = &read16;
+    PERIPHERAL->io16.write16 = &write16;
     PERIPHERAL->io.in = &in;
     PERIPHERAL->io.out = &out;
 })
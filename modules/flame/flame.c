@@ -0,0 +1,341 @@
+// Copyright (c) 2019-2024 Andreas T Jonsson <mail@andreasjonsson.se>
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+//
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+//
+// 3. This notice may not be removed or altered from any source
+//    distribution.
+
+// Sampling profiler for guest code. Every 'interval' cycles the current CS:IP and call chain is
+// recorded, and the samples are written as folded stacks when the emulator exits.
+// Use flamegraph.pl or speedscope to view the result.
+
+#include <vxt/vxtu.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_DEPTH 32
+#define NUM_BUCKETS 4096
+#define MAX_NAME 32
+
+struct symbol {
+    vxt_pointer addr;
+    char name[MAX_NAME];
+};
+
+struct stack_count {
+    struct stack_count *next;
+    unsigned long long count;
+    char stack[];
+};
+
+struct flame {
+    char path[256];
+    int interval;
+    bool shadow;
+
+    int num_symbols;
+    struct symbol *symbols;
+
+    unsigned long long samples;
+    struct stack_count *buckets[NUM_BUCKETS];
+};
+
+static int hex_digits(const char *s) {
+    int n = 0;
+    while (isxdigit((unsigned char)s[n])) n++;
+    return n;
+}
+
+static void add_symbol(struct flame *fl, vxt_pointer addr, const char *name, int len) {
+    if ((fl->num_symbols & 0xFF) == 0) {
+        struct symbol *syms = (struct symbol*)realloc(fl->symbols, sizeof(struct symbol) * (fl->num_symbols + 0x100));
+        if (!syms) return;
+        fl->symbols = syms;
+    }
+
+    struct symbol *sym = &fl->symbols[fl->num_symbols++];
+    sym->addr = addr;
+    if (len >= MAX_NAME) len = MAX_NAME - 1;
+    memcpy(sym->name, name, len);
+    sym->name[len] = 0;
+}
+
+// Returns the length of a label definition at the start of src. That is 'NAME:', 'NAME PROC' or 'NAME LABEL'.
+static int label_length(const char *src) {
+    int len = 0;
+    while (isalnum((unsigned char)src[len]) || (src[len] && strchr("_@$?", src[len]))) len++;
+    if (!len || (src[0] == '@') || isdigit((unsigned char)src[0]))
+        return 0;
+
+    if (src[len] == ':')
+        return len;
+
+    const char *s = &src[len];
+    while ((*s == ' ') || (*s == '\t')) s++;
+    if ((!strncmp(s, "PROC", 4) || !strncmp(s, "proc", 4) || !strncmp(s, "LABEL", 5) || !strncmp(s, "label", 5)) && (s != &src[len]))
+        return len;
+    return 0;
+}
+
+// Handles MS LINK map files, MASM or WASM listings and NASM listings. Addresses are relative to 'segment'.
+static bool load_symbols(struct flame *fl, const char *path, vxt_word segment) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        VXT_LOG("ERROR: Could not open symbol file: %s", path);
+        return false;
+    }
+
+    char line[512];
+    const char *pending = NULL;
+    char pending_name[MAX_NAME];
+    int pending_len = 0;
+    const int num = fl->num_symbols;
+
+    while (fgets(line, sizeof(line), fp)) {
+        const char *c = line;
+        while (*c == ' ') c++;
+        const int lead = (int)(c - line);
+
+        // MAP: ' 0000:0010       _main'
+        if ((hex_digits(c) == 4) && (c[4] == ':') && (hex_digits(&c[5]) == 4)) {
+            const vxt_word seg = (vxt_word)strtoul(c, NULL, 16);
+            const vxt_word off = (vxt_word)strtoul(&c[5], NULL, 16);
+            const char *name = &c[9];
+            while (*name == ' ') name++;
+
+            int len = 0;
+            while (name[len] && !isspace((unsigned char)name[len])) len++;
+            if (len && strncmp(name, "Abs", 3) && strncmp(name, "Imp", 3))
+                add_symbol(fl, VXT_POINTER(seg + segment, off), name, len);
+            continue;
+        }
+
+        // MASM or WASM: ' E05D\t\t\t\tPOST_CPU_TEST:'
+        if ((lead <= 1) && (hex_digits(c) == 4) && ((c[4] == ' ') || (c[4] == '\t'))) {
+            const vxt_word off = (vxt_word)strtoul(c, NULL, 16);
+            const char *src = strchr(c, '\t');
+            if (src) {
+                while (*src == '\t') src++;
+                const int len = label_length(src);
+                if (len) add_symbol(fl, VXT_POINTER(segment, off), src, len);
+            }
+            continue;
+        }
+
+        // NASM: '    12 00000010 B80000                  mov ax, 0'
+        // Labels on their own line get the address of the next line that emits something.
+        if ((lead > 1) && isdigit((unsigned char)*c)) {
+            while (isdigit((unsigned char)*c)) c++;
+            while (*c == ' ') c++;
+
+            const char *src = (strlen(line) > 40) ? &line[40] : NULL;
+            if (hex_digits(c) == 8) {
+                const vxt_word off = (vxt_word)strtoul(c, NULL, 16);
+                if (pending) {
+                    add_symbol(fl, VXT_POINTER(segment, off), pending_name, pending_len);
+                    pending = NULL;
+                }
+                if (src && (pending_len = label_length(src)))
+                    add_symbol(fl, VXT_POINTER(segment, off), src, pending_len);
+            } else if (src && (pending_len = label_length(src))) {
+                memcpy(pending_name, src, (pending_len < MAX_NAME) ? pending_len : (MAX_NAME - 1));
+                pending = pending_name;
+            }
+        }
+    }
+
+    fclose(fp);
+    VXT_LOG("Loaded %d symbols from: %s", fl->num_symbols - num, path);
+    return true;
+}
+
+static int compare_symbols(const void *a, const void *b) {
+    const vxt_pointer x = ((const struct symbol*)a)->addr;
+    const vxt_pointer y = ((const struct symbol*)b)->addr;
+    return (x > y) - (x < y);
+}
+
+static int symbolize(struct flame *fl, vxt_pointer addr, char *buf, int size) {
+    int lo = 0, hi = fl->num_symbols - 1, found = -1;
+    while (lo <= hi) {
+        const int mid = (lo + hi) / 2;
+        if (fl->symbols[mid].addr <= addr) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    if ((found >= 0) && ((addr - fl->symbols[found].addr) < 0x10000))
+        return snprintf(buf, size, "%s", fl->symbols[found].name);
+    return snprintf(buf, size, "%05X", addr);
+}
+
+static vxt_word read_word(vxt_system *s, vxt_word seg, vxt_word off) {
+    return ((vxt_word)vxt_system_read_byte(s, VXT_POINTER(seg, off + 1)) << 8) | vxt_system_read_byte(s, VXT_POINTER(seg, off));
+}
+
+// Checks that the return address follows a near CALL. This filters out code that uses BP for something else.
+static bool after_call(vxt_system *s, vxt_word cs, vxt_word ret) {
+    if (vxt_system_read_byte(s, VXT_POINTER(cs, ret - 3)) == 0xE8)
+        return true;
+
+    for (int i = 2; i <= 4; i++) {
+        if ((vxt_system_read_byte(s, VXT_POINTER(cs, ret - i)) == 0xFF) && ((vxt_system_read_byte(s, VXT_POINTER(cs, ret - i + 1)) & 0x38) == 0x10))
+            return true;
+    }
+    return false;
+}
+
+// Fills in caller addresses, innermost first, by following the chain of saved BP values.
+static int walk_frames(vxt_system *s, const struct vxt_registers *r, vxt_pointer *frames, int max) {
+    int n = 0;
+    vxt_word bp = r->bp;
+
+    while ((n < max) && bp && !(bp & 1)) {
+        const vxt_word ret = read_word(s, r->ss, bp + 2);
+        if (!after_call(s, r->cs, ret))
+            break;
+        frames[n++] = VXT_POINTER(r->cs, ret);
+
+        const vxt_word next = read_word(s, r->ss, bp);
+        if (next <= bp)
+            break;
+        bp = next;
+    }
+    return n;
+}
+
+static void add_sample(struct flame *fl, const char *stack) {
+    vxt_dword hash = 2166136261u;
+    for (const char *c = stack; *c; c++)
+        hash = (hash ^ (vxt_byte)*c) * 16777619u;
+
+    struct stack_count **bucket = &fl->buckets[hash & (NUM_BUCKETS - 1)];
+    for (struct stack_count *sc = *bucket; sc; sc = sc->next) {
+        if (!strcmp(sc->stack, stack)) {
+            sc->count++;
+            return;
+        }
+    }
+
+    const size_t len = strlen(stack) + 1;
+    struct stack_count *sc = (struct stack_count*)malloc(sizeof(struct stack_count) + len);
+    if (!sc) return;
+
+    memcpy(sc->stack, stack, len);
+    sc->count = 1;
+    sc->next = *bucket;
+    *bucket = sc;
+}
+
+static vxt_error timer(struct flame *fl, vxt_timer_id id, int cycles) {
+    (void)id; (void)cycles;
+    vxt_system *s = VXT_GET_SYSTEM(fl);
+    const struct vxt_registers *r = vxt_system_registers(s);
+
+    vxt_pointer frames[MAX_DEPTH];
+    frames[0] = VXT_POINTER(r->cs, r->ip);
+    int n = 1 + walk_frames(s, r, &frames[1], MAX_DEPTH - 1);
+    if ((n == 1) && fl->shadow)
+        n += vxt_system_profile_stack(s, &frames[1], MAX_DEPTH - 1);
+
+    // Folded stacks start with the outermost frame. Names are shorter than MAX_NAME so they always fit.
+    char stack[MAX_DEPTH * (MAX_NAME + 1)];
+    int len = 0;
+    for (int i = n - 1; i >= 0; i--) {
+        len += symbolize(fl, frames[i], &stack[len], MAX_NAME);
+        if (i) stack[len++] = ';';
+    }
+    stack[len] = 0;
+
+    add_sample(fl, stack);
+    fl->samples++;
+    return VXT_NO_ERROR;
+}
+
+static vxt_error install(struct flame *fl, vxt_system *s) {
+    qsort(fl->symbols, fl->num_symbols, sizeof(struct symbol), &compare_symbols);
+
+    const unsigned int us = (unsigned int)((double)fl->interval * 1000000.0 / (double)vxt_system_frequency(s));
+    vxt_system_install_timer(s, VXT_GET_PERIPHERAL(fl), us ? us : 1);
+
+    if (fl->shadow)
+        vxt_system_set_profiler(s, true);
+    return VXT_NO_ERROR;
+}
+
+static vxt_error destroy(struct flame *fl) {
+    FILE *fp = fopen(fl->path, "w");
+    if (!fp)
+        VXT_LOG("ERROR: Could not write: %s", fl->path);
+
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        while (fl->buckets[i]) {
+            struct stack_count *sc = fl->buckets[i];
+            if (fp) fprintf(fp, "%s %llu\n", sc->stack, sc->count);
+            fl->buckets[i] = sc->next;
+            free(sc);
+        }
+    }
+
+    if (fp) {
+        fclose(fp);
+        VXT_LOG("Wrote %llu samples to: %s", fl->samples, fl->path);
+    }
+
+    free(fl->symbols);
+    vxt_system_allocator(VXT_GET_SYSTEM(fl))(VXT_GET_PERIPHERAL(fl), 0);
+    return VXT_NO_ERROR;
+}
+
+static vxt_error config(struct flame *fl, const char *section, const char *key, const char *value) {
+    if (strcmp("flame", section))
+        return VXT_NO_ERROR;
+
+    if (!strcmp("interval", key)) {
+        fl->interval = atoi(value);
+    } else if (!strcmp("shadow", key)) {
+        fl->shadow = atoi(value) != 0;
+    } else if (!strcmp("symbols", key)) {
+        // symbols=path[,segment]
+        char path[256];
+        unsigned int segment = 0;
+        if (sscanf(value, "%255[^,],%x", path, &segment) >= 1)
+            load_symbols(fl, path, (vxt_word)segment);
+    }
+    return VXT_NO_ERROR;
+}
+
+static const char *name(struct flame *fl) {
+    (void)fl; return "Flame Graph Profiler";
+}
+
+VXTU_MODULE_CREATE(flame, {
+    snprintf(DEVICE->path, sizeof(DEVICE->path), "%s", *ARGS ? ARGS : "flame.folded");
+    DEVICE->interval = 10000;
+
+    PERIPHERAL->install = &install;
+    PERIPHERAL->destroy = &destroy;
+    PERIPHERAL->config = &config;
+    PERIPHERAL->timer = &timer;
+    PERIPHERAL->name = &name;
+})
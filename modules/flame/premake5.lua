@@ -0,0 +1,3 @@
+files {
+    "flame.c"
+}
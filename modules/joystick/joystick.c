@@ -88,6 +88,11 @@ static vxt_error timer(struct joystick *g, vxt_timer_id id, int cycles) {
     return VXT_NO_ERROR;
 }
 
+static int next_event(struct joystick *g, vxt_timer_id id) {
+    (void)g; (void)id;
+    return -1;
+}
+
 static bool push_event(struct vxt_peripheral *p, const struct frontend_joystick_event *ev) {
     struct joystick *g = VXT_GET_DEVICE(joystick, p);
     struct gameport_joystick *js = &g->joysticks[ev->id];
@@ -123,6 +128,7 @@ static struct vxt_peripheral *create(vxt_allocator *alloc, void *frontend, const
     PERIPHERAL->install = &install;
     PERIPHERAL->name = &name;
     PERIPHERAL->timer = &timer;
+    PERIPHERAL->next_event = &next_event;
     PERIPHERAL->io.in = &in;
     PERIPHERAL->io.out = &out;
 })
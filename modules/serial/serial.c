@@ -148,6 +148,12 @@ static vxt_error timer(struct serial *c, vxt_timer_id id, int cycles) {
 	return VXT_NO_ERROR;
 }
 
+// Host data is polled like frontend input, once per step.
+static int next_event(struct serial *c, vxt_timer_id id) {
+	(void)c; (void)id;
+	return -1;
+}
+
 static vxt_error install(struct serial *c, vxt_system *s) {
     for (int i = 0; i < VXT_MAX_PERIPHERALS; i++) {
         struct vxt_peripheral *ip = vxt_system_peripheral(s, (vxt_byte)i);
@@ -211,6 +217,7 @@ VXTU_MODULE_CREATE(serial, {
     PERIPHERAL->install = &install;
 	PERIPHERAL->destroy = &destroy;
 	PERIPHERAL->timer = &timer;
+	PERIPHERAL->next_event = &next_event;
 	PERIPHERAL->reset = &reset;
     PERIPHERAL->name = &name;
 })
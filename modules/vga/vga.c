@@ -287,6 +287,29 @@ static void write(struct vga_video *v, vxt_pointer addr, vxt_byte data) {
     }
 }
 
+static vxt_word read16(struct vga_video *v, vxt_pointer addr) {
+    if (!v->textmode && (v->bpp == 4) && !(v->reg.seq_reg[4] & 8))
+        return read(v, addr) | ((vxt_word)read(v, addr + 1) << 8);
+
+    addr -= MEMORY_START;
+    vxt_system_wait(VXT_GET_SYSTEM(v), VGA_WAITSTATES * 2);
+    return MEMORY(v->mem, addr) | ((vxt_word)MEMORY(v->mem, addr + 1) << 8);
+}
+
+static void write16(struct vga_video *v, vxt_pointer addr, vxt_word data) {
+    if (!v->textmode && (v->bpp == 4) && !(v->reg.seq_reg[4] & 8)) {
+        write(v, addr, (vxt_byte)(data & 0xFF));
+        write(v, addr + 1, (vxt_byte)(data >> 8));
+        return;
+    }
+
+    addr -= MEMORY_START;
+    v->is_dirty = true;
+    vxt_system_wait(VXT_GET_SYSTEM(v), VGA_WAITSTATES * 2);
+    MEMORY(v->mem, addr) = (vxt_byte)(data & 0xFF);
+    MEMORY(v->mem, addr + 1) = (vxt_byte)(data >> 8);
+}
+
 static vxt_byte in(struct vga_video *v, vxt_word port) {
     vxt_system_wait(VXT_GET_SYSTEM(v), VGA_WAITSTATES);
     switch (port) {
@@ -468,6 +491,12 @@ static vxt_error timer(struct vga_video *v, vxt_timer_id id, int cycles) {
     return VXT_NO_ERROR;
 }
 
+// The status bits toggle once per step no matter how long it is.
+static int next_event(struct vga_video *v, vxt_timer_id id) {
+    (void)v; (void)id;
+    return -1;
+}
+
 static vxt_dword border_color(struct vxt_peripheral *p) {
     (void)p;
     return 0;
@@ -534,8 +563,11 @@ static struct vxt_peripheral *vga_create(vxt_allocator *alloc, void *frontend, c
     PERIPHERAL->pclass = &pclass;
     PERIPHERAL->reset = &reset;
     PERIPHERAL->timer = &timer;
+    PERIPHERAL->next_event = &next_event;
     PERIPHERAL->io.read = &read;
     PERIPHERAL->io.write = &write;
+    PERIPHERAL->io16.read16 = &read16;
+    PERIPHERAL->io16.write16 = &write16;
     PERIPHERAL->io.in = &in;
     PERIPHERAL->io.out = &out;
 })
@@ -545,16 +577,9 @@ static struct vxt_peripheral *bios_create(vxt_allocator *alloc, void *frontend,
     if (fi && fi->resolve_path)
         args = fi->resolve_path(FRONTEND_BIOS_PATH, args);
 
-    int size = 0;
-    vxt_byte *data = vxtu_read_file(alloc, args, &size);
-    if (!data) {
+    struct vxt_peripheral *p = vxtu_rom_map(alloc, 0xC0000, args);
+    if (!p)
         VXT_LOG("Could not load VGA BIOS: %s", args);
-        return NULL;
-    }
-
-    struct vxt_peripheral *p = vxtu_memory_create(alloc, 0xC0000, size, true);
-    vxtu_memory_device_fill(p, data, size);
-    alloc(data, 0);
     return p;
 }
 
@@ -221,6 +221,9 @@ workspace "virtualxt"
         defines "VXT_EXPORT"
         removefiles { "lib/vxt/testing.h", "lib/vxt/testsuit.c" }
 
+        filter "toolset:clang or gcc"
+            links "m"
+
 	project "ebridge-tool"
 		kind "ConsoleApp"
 		targetname "ebridge"
@@ -262,6 +265,7 @@ workspace "virtualxt"
         }
 
         filter "toolset:clang or gcc"
+            links "m"
             buildoptions { "-Wno-atomic-alignment", "-Wno-deprecated-declarations" }
 
         -- TODO: Remove this filter! This is here to fix an issue with the GitHub builder.
@@ -483,6 +487,7 @@ if _OPTIONS["test"] then
         cleancommands "{RMDIR} test"
 
         filter { "toolset:clang or gcc" }
+            links "m"
             buildoptions { "-Wno-unused-function", "-Wno-unused-variable", "--coverage" }
             linkoptions "--coverage"
     
@@ -492,6 +497,7 @@ if _OPTIONS["test"] then
         local pattern = _OPTIONS["test"]
         local externals = ""
         local calls = ""
+        local benchmarks = ""
 
         for _,file in pairs(os.matchfiles("lib/vxt/**.c")) do
             if not pattern or string.find(file, pattern, 1, true) then
@@ -503,6 +509,11 @@ if _OPTIONS["test"] then
                         externals = externals .. string.format("extern int test_%s(struct Test T);\n", name)
                         calls = calls .. string.format("\tRUN_TEST(test_%s);\n", name)
                     end
+                    if string.startswith(line, "BENCH(") then
+                        local name = string.sub(line, 7, -2)
+                        externals = externals .. string.format("extern int bench_%s(struct Test T);\n", name)
+                        benchmarks = benchmarks .. string.format("\t\tRUN_TEST(bench_%s);\n", name)
+                    end
                 end
             end
         end
@@ -511,8 +522,11 @@ if _OPTIONS["test"] then
 
         -- Avoid using string.format here as the strings can be very large.
 
-        local head = '#include <stdio.h>\n#include "../lib/vxt/testing.h"\n\n#define RUN_TEST(t) { ok += run_test(t) ? 1 : 0; num++; }\n\n' .. externals
-        local body = "\t(void)argc; (void)argv;\n\tint ok = 0, num = 0;\n\n" .. calls
+        local head = '#include <stdio.h>\n#include <string.h>\n#include "../lib/vxt/testing.h"\n\n#define RUN_TEST(t) { ok += run_test(t) ? 1 : 0; num++; }\n\n' .. externals
+        local body = "\tint ok = 0, num = 0;\n\n" .. calls
+
+        -- Benchmarks depend on wall-clock time so they only run when asked for.
+        body = body .. '\n\tif ((argc > 1) && !strcmp(argv[1], "--bench")) {\n' .. benchmarks .. '\t}\n'
 
         body = body .. '\n\tprintf("%d/%d tests passed!\\n", ok, num);\n\treturn (num - ok) ? -1 : 0;\n'
         return head .. "\nint main(int argc, char *argv[]) {\n" .. body .. "}\n"